@@ -19,6 +19,7 @@
 #include "Controleo3Touch.h"
 #include "Controleo3Flash.h"
 #include "Controleo3SD.h"
+#include "Controleo3FileReader.h"
 
 
 #define LCD_WIDTH  		480
@@ -27,6 +28,5 @@
 #define LCD_MAX_Y		319
 
 #define BUZZER_PIN              MISO
-#define SD_DETECT_PIN           A0
 
 #endif // CONTROLEO3_H_
@@ -18,9 +18,46 @@
    uint8_t nfilecount=0;
 */
 
+// Open files.  A slot is free when its SdFile is closed.
+static SdFile fileSlots[SD_MAX_OPEN_FILES];
+
+// Data written to a file but not yet passed to the SdFile.  The data
+// belongs at the file's current position.  Buffers are found through the
+// SdFile, so every copy of a File object shares the same buffer.
+struct FileWriteBuffer {
+  SdFile *owner;      // file using the buffer, 0 if free
+  uint16_t length;    // bytes in data
+  uint8_t data[512];
+};
+static FileWriteBuffer writeBuffers[SD_WRITE_BUFFERS];
+
+// find the write buffer used by file.  If it has none then optionally
+// take a free one.  Returns 0 if there isn't one.
+static FileWriteBuffer *writeBufferFor(SdFile *file, boolean take) {
+  FileWriteBuffer *freeBuffer = 0;
+  for (uint8_t i = 0; i < SD_WRITE_BUFFERS; i++) {
+    if (writeBuffers[i].owner == file)
+      return &writeBuffers[i];
+    if (!writeBuffers[i].owner && !freeBuffer)
+      freeBuffer = &writeBuffers[i];
+  }
+  if (!take || !freeBuffer)
+    return 0;
+  freeBuffer->owner = file;
+  freeBuffer->length = 0;
+  return freeBuffer;
+}
+
 File::File(SdFile f, const char *n) {
-  // oh man you are kidding me, new() doesnt exist? Ok we do it by hand!
-  _file = (SdFile *)malloc(sizeof(SdFile)); 
+  // oh man you are kidding me, new() doesnt exist? Ok we use a fixed pool!
+  _file = 0;
+  _name[0] = 0;
+  for (uint8_t i = 0; i < SD_MAX_OPEN_FILES; i++) {
+    if (!fileSlots[i].isOpen()) {
+      _file = &fileSlots[i];
+      break;
+    }
+  }
   if (_file) {
     memcpy(_file, &f, sizeof(SdFile));
     
@@ -63,23 +100,77 @@ size_t File::write(uint8_t val) {
 }
 
 size_t File::write(const uint8_t *buf, size_t size) {
-  size_t t;
+  size_t t = size;
   if (!_file) {
     setWriteError();
     return 0;
   }
   _file->clearWriteError();
-  t = _file->write(buf, size);
-  if (_file->getWriteError()) {
-    setWriteError();
-    return 0;
+
+  // Without a buffer, write straight to the file.  Files opened for reading
+  // only don't get a buffer, so the write fails as it did before buffering
+  FileWriteBuffer *b = _file->isWritable() ? writeBufferFor(_file, true) : 0;
+  if (!b) {
+    t = _file->write(buf, size);
+    if (_file->getWriteError()) {
+      setWriteError();
+      return 0;
+    }
+    return t;
+  }
+
+  while (size) {
+    uint16_t offset = (_file->curPosition() + b->length) & 0X1FF;
+    uint16_t n;
+    if (b->length == 0 && offset == 0 && size >= 512) {
+      // whole blocks at a block boundary don't need to be buffered
+      n = size > 0XFE00 ? 0XFE00 : size & ~0X1FF;
+      _file->write(buf, n);
+      if (_file->getWriteError()) {
+        setWriteError();
+        return 0;
+      }
+    } else {
+      // fill the buffer up to the end of the block
+      n = 512 - offset;
+      if (n > size)
+        n = size;
+      memcpy(b->data + b->length, buf, n);
+      b->length += n;
+      if (((_file->curPosition() + b->length) & 0X1FF) == 0) {
+        if (!flushWriteBuffer()) {
+          setWriteError();
+          return 0;
+        }
+        // flushing gave the buffer back, so take one again for the rest
+        b = writeBufferFor(_file, true);
+      }
+    }
+    buf += n;
+    size -= n;
   }
   return t;
 }
 
+boolean File::flushWriteBuffer() {
+  FileWriteBuffer *b = writeBufferFor(_file, false);
+  if (!b)
+    return true;
+  uint16_t length = b->length;
+  // give the buffer back so another file can use it
+  b->owner = 0;
+  b->length = 0;
+  if (!length)
+    return true;
+  _file->write(b->data, length);
+  return !_file->getWriteError();
+}
+
 int File::peek() {
   if (! _file) 
     return 0;
+  if (!flushWriteBuffer())
+    setWriteError();
 
   int c = _file->read();
   if (c != -1) _file->seekCur(-1);
@@ -87,16 +178,20 @@ int File::peek() {
 }
 
 int File::read() {
-  if (_file) 
-    return _file->read();
-  return -1;
+  if (! _file)
+    return -1;
+  if (!flushWriteBuffer())
+    setWriteError();
+  return _file->read();
 }
 
 // buffered read for more efficient, high speed reading
 int File::read(void *buf, uint16_t nbyte) {
-  if (_file) 
-    return _file->read(buf, nbyte);
-  return 0;
+  if (! _file)
+    return 0;
+  if (!flushWriteBuffer())
+    setWriteError();
+  return _file->read(buf, nbyte);
 }
 
 int File::available() {
@@ -108,30 +203,39 @@ int File::available() {
 }
 
 void File::flush() {
-  if (_file)
-    _file->sync();
+  if (! _file)
+    return;
+  if (!flushWriteBuffer())
+    setWriteError();
+  _file->sync();
 }
 
 boolean File::seek(uint32_t pos) {
   if (! _file) return false;
+  if (!flushWriteBuffer()) return false;
 
   return _file->seekSet(pos);
 }
 
 uint32_t File::position() {
   if (! _file) return -1;
-  return _file->curPosition();
+  FileWriteBuffer *b = writeBufferFor(_file, false);
+  return _file->curPosition() + (b ? b->length : 0);
 }
 
 uint32_t File::size() {
   if (! _file) return 0;
-  return _file->fileSize();
+  uint32_t end = position();
+  return end > _file->fileSize() ? end : _file->fileSize();
 }
 
 void File::close() {
   if (_file) {
+    if (!flushWriteBuffer())
+      setWriteError();
     _file->close();
-    free(_file); 
+    // free the slot even if the close failed, e.g. the card was removed
+    *_file = SdFile();
     _file = 0;
 
     /* for debugging file open/close leaks
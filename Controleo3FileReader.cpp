@@ -0,0 +1,129 @@
+// Written by Peter Easton
+// Released under CC BY-NC-SA 3.0 license
+// Build a reflow oven: http://whizoo.com
+//
+// Buffered reader for parsing text files on the SD card
+//
+// Reading a file one character at a time with File::read() goes through SdFile::read() and the block cache
+// for every character.  This class reads 512 bytes at a time instead, so the SD library can read whole
+// blocks straight into the buffer, and the parsing is done on the buffer.
+//
+// Lines can end with CR, LF or both.  readUntil() and readNumber() treat either character as the end of a line.
+// Lines are counted by their LF characters, so errors in the file can be reported by line number.
+
+
+#include	"Controleo3FileReader.h"
+
+
+Controleo3FileReader::Controleo3FileReader(void)
+{
+    _file = 0;
+    _head = 0;
+    _count = 0;
+    _line = 1;
+}
+
+
+// Start reading from the current position of the file
+void Controleo3FileReader::begin(File *file)
+{
+    _file = file;
+    _head = 0;
+    _count = 0;
+    _line = 1;
+}
+
+
+// Read the next block of the file if the buffer is empty.  Return false at the end of the file
+bool Controleo3FileReader::fill(void)
+{
+    if (_head < _count)
+        return true;
+
+    _head = 0;
+    _count = 0;
+    if (!_file)
+        return false;
+    int n = _file->read(_buffer, FILE_READER_BUFFER_SIZE);
+    if (n > 0)
+        _count = n;
+    return _count != 0;
+}
+
+
+// Are there more characters to read?
+bool Controleo3FileReader::available(void)
+{
+    return fill();
+}
+
+
+// Return the next character without consuming it, or -1 at the end of the file
+int Controleo3FileReader::peek(void)
+{
+    return fill()? _buffer[_head] : -1;
+}
+
+
+// Return the next character, or -1 at the end of the file
+int Controleo3FileReader::next(void)
+{
+    if (!fill())
+        return -1;
+    if (_buffer[_head] == 0x0A)
+        _line++;
+    return _buffer[_head++];
+}
+
+
+// Read characters into str until the delimiter is found.  The delimiter is consumed but not saved.  Only
+// maxLength characters are saved (str must hold maxLength+1) and the rest are discarded.  str can be NULL
+// to skip characters.  Return false if the end of the file, or the end of the line if stopAtEndOfLine is
+// set, is reached before the delimiter
+bool Controleo3FileReader::readUntil(char delimiter, char *str, uint16_t maxLength, bool stopAtEndOfLine)
+{
+    uint16_t length = 0;
+    bool found = false;
+    int c;
+
+    while ((c = next()) >= 0) {
+        if (c == delimiter) {
+            found = true;
+            break;
+        }
+        if (stopAtEndOfLine && (c == 0x0A || c == 0x0D))
+            break;
+        if (str && length < maxLength)
+            str[length++] = c;
+    }
+
+    if (str)
+        str[length] = 0;
+    return found;
+}
+
+
+// Read an unsigned number.  Characters before the first digit are skipped, but not past the end of the
+// line.  The character after the number is not consumed.  Return false if there is no number on this line
+bool Controleo3FileReader::readNumber(uint16_t *num)
+{
+    int c;
+
+    *num = 0;
+
+    // Look for the first digit
+    while ((c = peek()) >= 0 && !isdigit(c)) {
+        if (c == 0x0A || c == 0x0D)
+            return false;
+        _head++;
+    }
+    if (c < 0)
+        return false;
+
+    // Read digits until something that isn't a digit
+    while ((c = peek()) >= 0 && isdigit(c)) {
+        *num = (*num * 10) + c - '0';
+        _head++;
+    }
+    return true;
+}
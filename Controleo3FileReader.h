@@ -0,0 +1,39 @@
+// Written by Peter Easton
+// Released under CC BY-NC-SA 3.0 license
+// Build a reflow oven: http://whizoo.com
+//
+// Buffered reader for parsing text files on the SD card
+
+
+#ifndef CONTROLEO3FILEREADER_H
+#define CONTROLEO3FILEREADER_H
+
+#include "Arduino.h"
+#include "Controleo3SD.h"
+
+// Whole SD blocks are read into the buffer
+#define FILE_READER_BUFFER_SIZE                 512
+
+
+class	Controleo3FileReader
+{
+public:
+    Controleo3FileReader(void);
+    void begin(File *file);
+    bool available(void);
+    int peek(void);
+    int next(void);
+    bool readUntil(char delimiter, char *str, uint16_t maxLength, bool stopAtEndOfLine = false);
+    bool readNumber(uint16_t *num);
+    uint16_t line(void) { return _line; }
+
+private:
+    bool fill(void);
+    File *_file;                                // The file being read
+    uint8_t _buffer[FILE_READER_BUFFER_SIZE];   // Data read from the file
+    uint16_t _head;                             // Offset of the next character in the buffer
+    uint16_t _count;                            // Number of characters in the buffer
+    uint16_t _line;                             // Line number of the next character, starting at 1
+};
+
+#endif  // CONTROLEO3FILEREADER_H
@@ -26,6 +26,13 @@
 // defaults to 60Hz (USA and others).  If your line voltage is 50Hz you should set CR0_NOISE_FILTER_50HZ.
 //
 // This library handles the full range of temperatures, including negative temperatures.
+//
+// More than one MAX31856 can be connected.  They share the data and clock lines, and each one has its own
+// chip-select pin which is passed to begin().  Use one instance of this class per MAX31856.
+//
+// readThermocouple() only returns the open-circuit and over/under voltage faults because those are the ones that
+// make the reading unusable.  Every bit of the Fault Status Register is counted though, along with the time it was
+// last seen and the latest cold-junction temperature.  Call getStatus() to get a copy of this telemetry.
 
 
 #include	"Controleo3MAX31856.h"
@@ -33,23 +40,28 @@
 
 // Define which pins are connected to the MAX31856.  The DRDY and FAULT outputs
 // from the MAX31856 are not used in this library.
-void Controleo3MAX31856::begin(void)
+void Controleo3MAX31856::begin(byte csPin)
 {
+    _csPin = csPin;
+
     // Initialize all the data pins
     pinMode(THERMOCOUPLE_SDI, OUTPUT);
-    pinMode(THERMOCOUPLE_CS, OUTPUT);
+    pinMode(_csPin, OUTPUT);
     pinMode(THERMOCOUPLE_CLK, OUTPUT);
     // Use a pullup on the data line to be able to detect "no communication"
     pinMode(THERMOCOUPLE_SDO, INPUT_PULLUP);
 
     // Default output pins state
-    digitalWrite(THERMOCOUPLE_CS, HIGH);
+    digitalWrite(_csPin, HIGH);
     digitalWrite(THERMOCOUPLE_CLK, HIGH);
 
     // Set up the shadow registers with the default values
     byte reg[NUM_REGISTERS] = {0x00,0x03,0xff,0x7f,0xc0,0x7f,0xff,0x80,0,0,0,0};
     for (int i=0; i<NUM_REGISTERS; i++)
         _registers[i] = reg[i];
+
+    // Start with no faults recorded
+    clearStatus();
 }
 
 
@@ -61,7 +73,7 @@ void Controleo3MAX31856::writeRegister(byte registerNum, byte data)
         return;
 
     // Select the MAX31856 chip
-    digitalWrite(THERMOCOUPLE_CS, LOW);
+    digitalWrite(_csPin, LOW);
 
     // Write the register number, with the MSB set to indicate a write
     writeByte(WRITE_OPERATION(registerNum));
@@ -70,7 +82,7 @@ void Controleo3MAX31856::writeRegister(byte registerNum, byte data)
     writeByte(data);
 
     // Deselect MAX31856 chip
-    digitalWrite(THERMOCOUPLE_CS, HIGH);
+    digitalWrite(_csPin, HIGH);
 
     // Save the register value, in case the registers need to be restored
     _registers[registerNum] = data;
@@ -87,7 +99,7 @@ double	Controleo3MAX31856::readThermocouple(byte unit)
     long data;
 
     // Select the MAX31856 chip
-    digitalWrite(THERMOCOUPLE_CS, LOW);
+    digitalWrite(_csPin, LOW);
 
     // Read data starting with register 0x0c
     writeByte(READ_OPERATION(0x0c));
@@ -96,17 +108,26 @@ double	Controleo3MAX31856::readThermocouple(byte unit)
     data = readData();
 
     // Deselect MAX31856 chip
-    digitalWrite(THERMOCOUPLE_CS, HIGH);
+    digitalWrite(_csPin, HIGH);
+
+    _status.numReadings++;
 
     // If there is no communication from the IC then data will be all 1's because
     // of the internal pullup on the data line (INPUT_PULLUP)
-    if (data == (long) 0xFFFFFFFF)
+    if (data == (long) 0xFFFFFFFF) {
+        _status.noCommunication++;
         return NO_MAX31856;
+    }
 
     // If the value is zero then the temperature could be exactly 0.000 (rare), or
     // the IC's registers are uninitialized.
-    if (data == 0 && verifyMAX31856() == NO_MAX31856)
+    if (data == 0 && verifyMAX31856() == NO_MAX31856) {
+        _status.noCommunication++;
         return NO_MAX31856;
+    }
+
+    // Record all the faults in the Fault Status Register, not just the ones returned below
+    updateStatus(data & 0xFF);
 
     // Was there an error?
     if (data & SR_FAULT_OPEN)
@@ -141,7 +162,7 @@ double	Controleo3MAX31856::readJunction(byte unit)
     long data, temperatureOffset;
 
     // Select the MAX31856 chip
-    digitalWrite(THERMOCOUPLE_CS, LOW);
+    digitalWrite(_csPin, LOW);
 
     // Read data starting with register 8
     writeByte(READ_OPERATION(8));
@@ -150,7 +171,7 @@ double	Controleo3MAX31856::readJunction(byte unit)
     data = readData();
 
     // Deselect MAX31856 chip
-    digitalWrite(THERMOCOUPLE_CS, HIGH);
+    digitalWrite(_csPin, HIGH);
 
     // If there is no communication from the IC then data will be all 1's because
     // of the internal pullup on the data line (INPUT_PULLUP)
@@ -183,6 +204,7 @@ double	Controleo3MAX31856::readJunction(byte unit)
 
     // Convert to Celsius
     temperature *= 0.015625;
+    _status.coldJunction = temperature;
 	
     // Convert to Fahrenheit if desired
     if (unit == FAHRENHEIT)
@@ -193,6 +215,73 @@ double	Controleo3MAX31856::readJunction(byte unit)
 }
 
 
+// Start a single conversion.  This is only needed when CR0_AUTOMATIC_CONVERSION is off.  The
+// CR0_ONE_SHOT bit clears itself when the conversion is done so it isn't saved in the shadow register.
+void Controleo3MAX31856::startOneShot(void)
+{
+    // Select the MAX31856 chip
+    digitalWrite(_csPin, LOW);
+
+    // Write CR0 with the one-shot bit set
+    writeByte(WRITE_OPERATION(REGISTER_CR0));
+    writeByte(_registers[REGISTER_CR0] | CR0_ONE_SHOT);
+
+    // Deselect MAX31856 chip
+    digitalWrite(_csPin, HIGH);
+}
+
+
+// Get the typical time (in ms) for one conversion, based on the current CR0 and CR1 settings.
+// From the datasheet: the first (or one-shot) conversion takes 143ms (60Hz filter) or 169ms (50Hz),
+// subsequent automatic conversions take 82ms or 98ms, and each extra averaged sample adds 33.33ms or 40ms.
+unsigned int Controleo3MAX31856::getConversionTime(void)
+{
+    boolean filter50Hz = _registers[REGISTER_CR0] & CR0_NOISE_FILTER_50HZ;
+    byte averaging = (_registers[REGISTER_CR1] >> 4) & 0x07;
+    unsigned int samples = 1 << (averaging > 4? 4: averaging);
+    unsigned int conversionTime;
+
+    if (_registers[REGISTER_CR0] & CR0_AUTOMATIC_CONVERSION)
+        conversionTime = filter50Hz? 98: 82;
+    else
+        conversionTime = filter50Hz? 169: 143;
+
+    return conversionTime + (samples - 1) * (filter50Hz? 40: 33);
+}
+
+
+// Get a copy of the fault and cold-junction telemetry.  Readings are usually taken from
+// an interrupt, so make sure the copy isn't updated halfway through
+void Controleo3MAX31856::getStatus(MAX31856Status *status)
+{
+    noInterrupts();
+    memcpy(status, &_status, sizeof(MAX31856Status));
+    interrupts();
+}
+
+
+// Reset all the fault counters
+void Controleo3MAX31856::clearStatus(void)
+{
+    noInterrupts();
+    memset(&_status, 0, sizeof(MAX31856Status));
+    interrupts();
+}
+
+
+// Count each fault bit that is set in the Fault Status Register, and remember when it happened
+void Controleo3MAX31856::updateStatus(byte sr)
+{
+    _status.status = sr;
+    for (int i=0; i<NUM_SR_FAULT_BITS; i++) {
+        if (sr & (1 << i)) {
+            _status.faultCount[i]++;
+            _status.lastFaultTime[i] = millis();
+        }
+    }
+}
+
+
 // When the MAX31856 is uninitialzed and either the junction or thermocouple temperature is read it will return 0.
 // This is a valid temperature, but could indicate that the registers need to be initialized.
 double Controleo3MAX31856::verifyMAX31856()
@@ -200,7 +289,7 @@ double Controleo3MAX31856::verifyMAX31856()
     long data, reg;
 
     // Select the MAX31856 chip
-    digitalWrite(THERMOCOUPLE_CS, LOW);
+    digitalWrite(_csPin, LOW);
 
     // Read data starting with register 0
     writeByte(READ_OPERATION(0));
@@ -209,7 +298,7 @@ double Controleo3MAX31856::verifyMAX31856()
     data = readData();
 
     // Deselect MAX31856 chip
-    digitalWrite(THERMOCOUPLE_CS, HIGH);
+    digitalWrite(_csPin, HIGH);
 
     // If there is no communication from the IC then data will be all 1's because
     // of the internal pullup on the data line (INPUT_PULLUP)
@@ -223,7 +312,7 @@ double Controleo3MAX31856::verifyMAX31856()
 
     // Communication to the IC is working, but the register values are not correct
     // Select the MAX31856 chip
-    digitalWrite(THERMOCOUPLE_CS, LOW);
+    digitalWrite(_csPin, LOW);
 
     // Start writing from register 0
     writeByte(WRITE_OPERATION(0));
@@ -233,7 +322,7 @@ double Controleo3MAX31856::verifyMAX31856()
         writeByte(_registers[i]);
 
     // Deselect MAX31856 chip
-    digitalWrite(THERMOCOUPLE_CS, HIGH);
+    digitalWrite(_csPin, HIGH);
 
     // For now, return an error but soon valid temperatures will be returned
     return NO_MAX31856;
@@ -70,10 +70,23 @@
 #define NO_MAX31856                             10002   // MAX31856 not communicating or not connected
 #define IS_MAX31856_ERROR(x)                    (x >= FAULT_OPEN && x <= NO_MAX31856)
 
+// Fault telemetry.  The counters are indexed by the bit number in the Fault Status Register (SR)
+#define NUM_SR_FAULT_BITS                       8
+
+typedef struct {
+    byte          status;                               // Raw Fault Status Register from the latest reading
+    float         coldJunction;                         // Cold-junction temperature (Celsius) from the latest readJunction()
+    unsigned long numReadings;                          // Number of thermocouple readings taken
+    unsigned long noCommunication;                      // Number of readings where the MAX31856 didn't respond
+    unsigned long faultCount[NUM_SR_FAULT_BITS];        // Number of readings with this SR bit set
+    unsigned long lastFaultTime[NUM_SR_FAULT_BITS];     // millis() when this SR bit was last set (0 = never)
+} MAX31856Status;
+
 #define CELSIUS                                 0
 #define FAHRENHEIT                              1
 
-// Pins used to connect to the MAX31856 IC
+// Pins used to connect to the MAX31856 IC.  SDI, SDO and CLK are shared by all MAX31856's, but each
+// one must have its own chip-select.  THERMOCOUPLE_CS is the one on the Controleo3 board.
 #define THERMOCOUPLE_SDI                        6
 #define THERMOCOUPLE_SDO                        7
 #define THERMOCOUPLE_CS                         21 // SCL
@@ -83,16 +96,23 @@
 class	Controleo3MAX31856
 {
 public:
-    void begin(void);
+    void begin(byte csPin = THERMOCOUPLE_CS);
     void writeRegister(byte, byte);
     double readThermocouple(byte unit);
     double readJunction(byte unit);
+    void getStatus(MAX31856Status *status);
+    void clearStatus(void);
+    void startOneShot(void);
+    unsigned int getConversionTime(void);
 
 private:
     long readData();
     void writeByte(byte);
     double verifyMAX31856();
+    void updateStatus(byte sr);
+    byte _csPin;                         // Chip-select for this MAX31856
     byte _registers[NUM_REGISTERS];      // Shadow registers.  Registers can be restored if power to MAX31855 is lost
+    MAX31856Status _status;              // Fault and cold-junction telemetry
 };
 
 #endif  // CONTROLEO3MAX31856_H
@@ -334,7 +334,53 @@ boolean callback_rmdir(SdFile& parentDir, char *filePathComponent,
 
 
 
+// Set by the card detect interrupt when a card is inserted or removed.
+// Starts true so the first call to `begin` mounts the card.
+static volatile boolean cardChanged = true;
+
+static void cardDetectISR(void) {
+  cardChanged = true;
+}
+
+void SDClass::attachCardDetect() {
+  if (cardDetectAttached)
+    return;
+  pinMode(SD_DETECT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(SD_DETECT_PIN), cardDetectISR, CHANGE);
+  cardDetectAttached = true;
+}
+
+boolean SDClass::cardPresent() {
+  attachCardDetect();
+  return digitalRead(SD_DETECT_PIN) == LOW;
+}
+
+Sd2Card *SDClass::mountedCard() {
+  return (mounted && !cardChanged)? &card : 0;
+}
+
 boolean SDClass::begin() {
+  /*
+
+    Mounts the card if it isn't already mounted.  A mounted card is only
+    initialised again after the card detect interrupt has seen a card
+    inserted or removed.
+
+    Return true if a card is mounted, false otherwise.
+
+   */
+
+  attachCardDetect();
+  if (mounted && !cardChanged)
+    return true;
+
+  // Clear the flag first, so a change during the mount is seen next time
+  cardChanged = false;
+  mounted = cardPresent() && mount();
+  return mounted;
+}
+
+boolean SDClass::mount() {
   /*
 
     Performs the initialisation required by the sdfatlib library.
@@ -343,7 +389,8 @@ boolean SDClass::begin() {
 
    */
 
-    if (!card.init()) {
+    // Try initializing twice.  Necessary if good card follows bad one
+    if (!card.init() && !card.init()) {
         SerialUSB.print("SDClass::begin - Card failed to initialize");
         return false;
     }
@@ -484,6 +531,39 @@ File SDClass::open(const char *filepath, uint8_t mode) {
 }
 
 
+File SDClass::openPreallocated(const char *filepath, uint32_t size) {
+  /*
+
+     Create the supplied file path with `size` bytes already allocated
+     in one contiguous run of clusters.  Appending to the file won't
+     update the FAT or directory entry until it is closed, so a flush()
+     only writes the data.
+
+     An attempt to create a file that already exists is an error.
+
+   */
+
+  int pathidx;
+
+  SdFile parentdir = getParentDir(filepath, &pathidx);
+  filepath += pathidx;
+
+  // failed to open a subdir, or no file name
+  if (!parentdir.isOpen() || !filepath[0])
+    return File();
+
+  SdFile file;
+  boolean created = file.createPreallocated(parentdir.isRoot() ? &root : &parentdir, filepath, size);
+
+  // dont close the root!
+  if (!parentdir.isRoot())
+    parentdir.close();
+  if (!created)
+    return File();
+  return File(file, filepath);
+}
+
+
 /*
 File SDClass::open(char *filepath, uint8_t mode) {
   //
@@ -623,6 +703,27 @@ File File::openNextFile(uint8_t mode) {
   return File();
 }
 
+// read the next file or subdirectory entry, without opening it
+int8_t File::readDir(dir_t *dir) {
+  if (!isDirectory())
+    return -1;
+  return _file->readDir(dir);
+}
+
+// open the entry just returned by readDir().  The entry is opened by its
+// position in the directory so the directory isn't searched for its name
+File File::openEntry(dir_t *dir, uint8_t mode) {
+  SdFile f;
+  char name[13];
+
+  if (!isDirectory() || _file->curPosition() < sizeof(dir_t))
+    return File();
+  _file->dirName(*dir, name);
+  if (!f.open(_file, (uint16_t) (_file->curPosition() / sizeof(dir_t) - 1), mode))
+    return File();
+  return File(f, name);
+}
+
 void File::rewindDirectory(void) {  
   if (isDirectory())
     _file->rewind();
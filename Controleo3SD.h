@@ -23,6 +23,17 @@
 #define FILE_READ O_READ
 #define FILE_WRITE (O_READ | O_WRITE | O_CREAT)
 
+// The card detect switch pulls this pin low when a card is inserted
+#define SD_DETECT_PIN           A0
+
+// Files and directories that can be open at the same time.  Each open file
+// has its own SdFile state, taken from a fixed pool instead of the heap.
+#define SD_MAX_OPEN_FILES       6
+// Files that can have buffered writes at the same time.  A write buffer
+// collects small writes into whole blocks, which go straight to the card
+// instead of through the volume's shared block cache.
+#define SD_WRITE_BUFFERS        2
+
 namespace SDLib {
 
 class File : public Stream {
@@ -30,6 +41,9 @@ class File : public Stream {
   char _name[13]; // our name
   SdFile *_file;  // underlying file pointer
 
+  // write out any data buffered for this file
+  boolean flushWriteBuffer();
+
 public:
   File(SdFile f, const char *name);     // wraps an underlying SdFile
   File(void);      // 'empty' constructor
@@ -53,6 +67,11 @@ public:
   boolean isDirectory(void);
   File openNextFile(uint8_t mode = O_RDONLY);
   void rewindDirectory(void);
+
+  // Read the next file or subdirectory entry without opening it, then
+  // optionally open the entry that was just read
+  int8_t readDir(dir_t *dir);
+  File openEntry(dir_t *dir, uint8_t mode = O_RDONLY);
   
   using Print::write;
 };
@@ -65,19 +84,40 @@ private:
   SdVolume volume;
   SdFile root;
   
+  // true once the volume is mounted, until the card is changed
+  boolean mounted;
+  boolean cardDetectAttached;
+
   // my quick&dirty iterator, should be replaced
   SdFile getParentDir(const char *filepath, int *indx);
+  // Initialise the card and mount the volume, even if already mounted
+  boolean mount();
+  void attachCardDetect();
 public:
   // This needs to be called to set up the connection to the SD card
-  // before other methods are used.
+  // before other methods are used.  The card stays mounted until the card
+  // detect interrupt sees it removed or replaced, so calling this again
+  // is cheap.
   boolean begin();
+
+  // Returns true if there is a card in the socket.
+  boolean cardPresent();
+
+  // The mounted card, for diagnostics such as its speed class and
+  // measured throughput.  Returns 0 if no card is mounted.
+  Sd2Card *mountedCard();
   
   // Open the specified file/directory with the supplied mode (e.g. read or
   // write, etc). Returns a File object for interacting with the file.
-  // Note that currently only one file can be open at a time.
+  // Up to SD_MAX_OPEN_FILES files and directories can be open at a time.
   File open(const char *filename, uint8_t mode = FILE_READ);
   File open(const String &filename, uint8_t mode = FILE_READ) { return open( filename.c_str(), mode ); }
 
+  // Create a new file with `size` bytes of contiguous clusters, for logging.
+  // Writes only touch data blocks until the file is closed, which trims it
+  // to the length written.  Fails if the file already exists.
+  File openPreallocated(const char *filepath, uint32_t size);
+
   // Methods to determine if the requested file path exists.
   boolean exists(char *filepath);
   boolean exists(const String &filepath) { return exists(filepath.c_str()); }
@@ -14,8 +14,19 @@
 
 #include "Controleo3Touch.h"
 
+volatile uint32_t Controleo3Touch::eventTime[TOUCH_EVENT_QUEUE_SIZE];
+volatile uint8_t Controleo3Touch::eventHead = 0;
+volatile uint8_t Controleo3Touch::eventTail = 0;
+volatile bool Controleo3Touch::isReading = false;
+
 Controleo3Touch::Controleo3Touch()
 {
+    interruptEnabled = false;
+    historyCount = 0;
+    samplesTaken = 0;
+    lastHistoryTime = 0;
+    memset(calibrationMatrix, 0, sizeof(calibrationMatrix));
+
     // Get the addresses of Port A (D2 is on port A)
     portAOut   = portOutputRegister(digitalPinToPort(2));
     portAIn    = portInputRegister(digitalPinToPort(2));
@@ -36,7 +47,7 @@ void Controleo3Touch::begin()
     // Set some pins as inputs (MISO, PEN_IRQ)
     *portAMode &= CLEARBIT11;	// MISO
     *portAOut  &= CLEARBIT11;	// MISO
-    pinMode(23, INPUT);			// PEN_IRQ
+    pinMode(TOUCH_PEN_IRQ_PIN, INPUT);	// PEN_IRQ
 
     // Initialize pins states
     TOUCH_CLK_ACTIVE;
@@ -45,16 +56,16 @@ void Controleo3Touch::begin()
 }
 
 
+// Calibrate using the raw readings at the four corners of the screen.  This is the old
+// calibration format; it is converted to the calibration matrix.
 void Controleo3Touch::calibrate(int16_t tlX,int16_t trX,int16_t blX,int16_t brX,int16_t tlY,int16_t blY,int16_t trY,int16_t brY)
 {
-    topLeftX = tlX;
-    topRightX = trX;
-    bottomLeftX = blX;
-    bottomRightX = brX;
-    topLeftY = tlY;
-    bottomLeftY = blY;
-    topRightY = trY;
-    bottomRightY = brY;
+    int16_t rawX[4] = {tlX, trX, blX, brX};
+    int16_t rawY[4] = {tlY, trY, blY, brY};
+    int16_t screenX[4] = {0, LCD_MAX_X, 0, LCD_MAX_X};
+    int16_t screenY[4] = {0, 0, LCD_MAX_Y, LCD_MAX_Y};
+
+    calibrate(rawX, rawY, screenX, screenY, 4);
 #ifdef TOUCH_DEBUG
     SerialUSB.print("Touch data: tlX=" + String(tlX));
     SerialUSB.print(" trX=" + String(trX));
@@ -68,6 +79,82 @@ void Controleo3Touch::calibrate(int16_t tlX,int16_t trX,int16_t blX,int16_t brX,
 }
 
 
+// Calculate the determinant of a 3x3 matrix
+static double determinant(double m[3][3])
+{
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+         - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+         + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+}
+
+
+// Solve m * (a, b, c) = rhs using Cramer's rule, and store the fixed-point result in row
+static void solveCalibrationRow(double m[3][3], double *rhs, double det, int32_t *row)
+{
+    double replaced[3][3];
+
+    for (uint8_t col = 0; col < 3; col++) {
+        memcpy(replaced, m, sizeof(replaced));
+        for (uint8_t i = 0; i < 3; i++)
+            replaced[i][col] = rhs[i];
+        double value = determinant(replaced) / det * (1L << TOUCH_MATRIX_SHIFT);
+        row[col] = (int32_t) (value < 0? value - 0.5: value + 0.5);
+    }
+}
+
+
+// Calculate the calibration matrix from "num" touch points (at least 3).  If there are more than
+// 3 points a least-squares fit is done.  This is only done once, so floating point is fine here.
+// Returns false if the points can't be used (for example, if they are all in a straight line).
+bool Controleo3Touch::calibrate(int16_t *rawX, int16_t *rawY, int16_t *screenX, int16_t *screenY, uint8_t num)
+{
+    double m[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+    double rhsX[3] = {0, 0, 0}, rhsY[3] = {0, 0, 0};
+
+    if (num < 3)
+        return false;
+
+    // Build the normal equations
+    for (uint8_t i = 0; i < num; i++) {
+        double point[3] = {(double) rawX[i], (double) rawY[i], 1};
+        for (uint8_t row = 0; row < 3; row++) {
+            for (uint8_t col = 0; col < 3; col++)
+                m[row][col] += point[row] * point[col];
+            rhsX[row] += point[row] * screenX[i];
+            rhsY[row] += point[row] * screenY[i];
+        }
+    }
+
+    double det = determinant(m);
+    if (fabs(det) < 1)
+        return false;
+
+    solveCalibrationRow(m, rhsX, det, calibrationMatrix);
+    solveCalibrationRow(m, rhsY, det, calibrationMatrix + 3);
+#ifdef TOUCH_DEBUG
+    SerialUSB.print("Touch matrix:");
+    for (uint8_t i = 0; i < TOUCH_MATRIX_SIZE; i++)
+        SerialUSB.print(" " + String(calibrationMatrix[i]));
+    SerialUSB.println();
+#endif
+    return true;
+}
+
+
+// Set the calibration matrix (previously obtained from getCalibration)
+void Controleo3Touch::setCalibration(int32_t *matrix)
+{
+    memcpy(calibrationMatrix, matrix, sizeof(calibrationMatrix));
+}
+
+
+// Get the calibration matrix, so it can be saved
+void Controleo3Touch::getCalibration(int32_t *matrix)
+{
+    memcpy(matrix, calibrationMatrix, sizeof(calibrationMatrix));
+}
+
+
 // If the touchscreen is pressed the IRQ pin will be high
 bool Controleo3Touch::isPressed(void)
 {
@@ -75,25 +162,101 @@ bool Controleo3Touch::isPressed(void)
 }
 
 
-#define NUM_SAMPLES  	8
+// Use the PEN_IRQ interrupt to detect touches.  Once enabled, read() doesn't talk to the
+// touch controller unless the screen has been touched.
+void Controleo3Touch::enableInterrupt(void)
+{
+    flushEvents();
+    // PEN_IRQ goes low when the screen is touched
+    attachInterrupt(TOUCH_PEN_IRQ_PIN, penIRQHandler, FALLING);
+    interruptEnabled = true;
+}
+
+
+// Interrupt handler for PEN_IRQ.  Timestamp the touch and add it to the queue
+void Controleo3Touch::penIRQHandler(void)
+{
+    // PEN_IRQ toggles while the controller is taking readings
+    if (isReading)
+        return;
+
+    uint8_t next = (eventHead + 1) % TOUCH_EVENT_QUEUE_SIZE;
+    // Drop the event if the queue is full
+    if (next == eventTail)
+        return;
+    eventTime[eventHead] = millis();
+    eventHead = next;
+}
+
+
+// Returns true if the screen may have been touched.  With the interrupt enabled this is
+// cheap when nothing is happening; the pin is only checked if there are queued events.
+bool Controleo3Touch::available(void)
+{
+    if (!interruptEnabled)
+        return TOUCH_PEN_IRQ;
+
+    // Has the screen been touched?
+    if (eventHead == eventTail)
+        return false;
+
+    // Is the pen still down?
+    if (TOUCH_PEN_IRQ)
+        return true;
+
+    // The pen has been lifted, so the queued events are over
+    flushEvents();
+    return false;
+}
+
+
+// Get the time (millis) of the oldest queued pen-down event, or 0 if there isn't one
+uint32_t Controleo3Touch::getPenDownTime(void)
+{
+    if (eventHead == eventTail)
+        return 0;
+    return eventTime[eventTail];
+}
+
+
+// Empty the event queue
+void Controleo3Touch::flushEvents(void)
+{
+    noInterrupts();
+    eventTail = eventHead;
+    interrupts();
+}
+
+
+#define MAX_SAMPLES  	8     // Give up if the samples haven't settled after this many
+#define WINDOW_SAMPLES  3     // The number of consecutive samples that must agree
 #define MAX_DEVIATION   20
+#define HISTORY_TIMEOUT 100   // Forget the history if there hasn't been a reading for this long (ms)
 
 // Read touch controller samples.  Returns true if the reading is valid, or false if
 // there is no touch, or the touch readings deviate too much (indicating rapid finger movement up/down).
-// Eight samples are taken and averaged out to get a more accurate indication of where the user is touching
-// on the screen.
+// Samples are taken until the last few agree with each other, which is usually after WINDOW_SAMPLES
+// samples.  The result is the median of the last few accepted readings.
 bool Controleo3Touch::readRaw(int16_t *x, int16_t *y)
 {
-    uint16_t xValues[NUM_SAMPLES];
-    uint16_t yValues[NUM_SAMPLES];
+    uint16_t xValues[MAX_SAMPLES];
+    uint16_t yValues[MAX_SAMPLES];
+    int16_t averageX, averageY;
+    uint8_t count;
+    bool settled = false;
     
 	// See if there is a touch
-    if (!TOUCH_PEN_IRQ)
+    if (!TOUCH_PEN_IRQ) {
+        // The pen has been lifted, so start the history again
+        historyCount = 0;
     	return false;
+    }
 
+    // Ignore PEN_IRQ changes caused by the readings
+    isReading = true;
 	TOUCH_CS_IDLE;
 
-    for (int count = 0; count < NUM_SAMPLES; count++) {
+    for (count = 0; count < MAX_SAMPLES && !settled; count++) {
         // Read X value
         write8(0x90);
         TOUCH_MOSI_IDLE;
@@ -104,46 +267,103 @@ bool Controleo3Touch::readRaw(int16_t *x, int16_t *y)
         TOUCH_MOSI_IDLE;
         TOUCH_PULSE_CLK;
         yValues[count] = read12();
+
+        // A high deviation indicates the finger is moving onto or away from the screen
+        // Stop as soon as the last few X and Y values differ by less than MAX_DEVIATION
+        if (count >= WINDOW_SAMPLES - 1) {
+            uint8_t first = count + 1 - WINDOW_SAMPLES;
+            settled = calcDeviation(xValues + first, WINDOW_SAMPLES, &averageX) <= MAX_DEVIATION &&
+                      calcDeviation(yValues + first, WINDOW_SAMPLES, &averageY) <= MAX_DEVIATION;
+        }
     }
 
 	TOUCH_CS_ACTIVE;
+    isReading = false;
+
+    if (!settled)
+        return false;
+    samplesTaken = count;
+
+    // Add this reading to the history
+    if (millis() - lastHistoryTime > HISTORY_TIMEOUT)
+        historyCount = 0;
+    lastHistoryTime = millis();
+    if (historyCount == TOUCH_HISTORY_SIZE) {
+        // Drop the oldest reading
+        memmove(historyX, historyX + 1, sizeof(historyX) - sizeof(historyX[0]));
+        memmove(historyY, historyY + 1, sizeof(historyY) - sizeof(historyY[0]));
+    }
+    else
+        historyCount++;
+    historyX[historyCount - 1] = averageX;
+    historyY[historyCount - 1] = averageY;
 
-    // A high deviation indicates the finger is moving onto or away from the screen
-    // Reject if X values differ by more than DEVIATION
-    if (calcDeviation(xValues, NUM_SAMPLES, x) > MAX_DEVIATION)
-      return false;
-
-    // Reject if Y values differ by more than DEVIATION
-    if (calcDeviation(yValues, NUM_SAMPLES, y) > MAX_DEVIATION)
-      return false;
+    // Use the median of the history, to reject the occasional bad reading
+    *x = median(historyX, historyCount);
+    *y = median(historyY, historyCount);
 
 #ifdef TOUCH_DEBUG
     SerialUSB.print("X = ");
     SerialUSB.print(*x);
     SerialUSB.print("   Y = ");
-    SerialUSB.println(*y);
+    SerialUSB.print(*y);
+    SerialUSB.print("   samples = ");
+    SerialUSB.print(samplesTaken);
+    if (getPenDownTime()) {
+        SerialUSB.print("   ms since pen down = ");
+        SerialUSB.print(millis() - getPenDownTime());
+    }
+    SerialUSB.println();
 #endif
     return true;
 }
 
 
+// The number of samples taken for the last accepted reading
+uint8_t Controleo3Touch::getSamplesTaken(void)
+{
+    return samplesTaken;
+}
+
+
+// Get the median of a few numbers.  With 2 numbers, this is the average
+int16_t Controleo3Touch::median(int16_t *array, uint8_t num)
+{
+    int16_t sorted[TOUCH_HISTORY_SIZE];
+
+    // Insertion sort (there are only a few numbers)
+    for (uint8_t i = 0; i < num; i++) {
+        uint8_t j = i;
+        for (; j > 0 && sorted[j-1] > array[i]; j--)
+            sorted[j] = sorted[j-1];
+        sorted[j] = array[i];
+    }
+
+    if (num & 1)
+        return sorted[num / 2];
+    return (sorted[num / 2 - 1] + sorted[num / 2]) / 2;
+}
+
+
 // Gets raw touch data and then maps it to the LCD coordinates
 bool Controleo3Touch::read(int16_t *x, int16_t *y)
 {
+    // Don't talk to the touch controller if the screen hasn't been touched
+    if (interruptEnabled && !available())
+      return false;
+
     // Read the raw touch values
     if (readRaw(x, y) == false)
       return false;
 
-    // Get the approximate Y value
-    int16_t yy = map(*y, topLeftY, bottomRightY, 0, LCD_MAX_Y);
-
-    // Get a weighted X value and constrain it to the screen
-    *x = ((map(*x, topLeftX, topRightX, 0, LCD_MAX_X) * yy) + (map(*x, bottomLeftX, bottomRightX, 0, LCD_MAX_X) * (LCD_MAX_Y - yy))) / LCD_HEIGHT;
-    *x = constrain(*x, 0, LCD_MAX_X);
+    // Apply the calibration matrix.  The raw values are 12 bits so this can't overflow
+    int32_t rawX = *x, rawY = *y;
+    int32_t screenX = (calibrationMatrix[0] * rawX + calibrationMatrix[1] * rawY + calibrationMatrix[2] + (1L << (TOUCH_MATRIX_SHIFT - 1))) >> TOUCH_MATRIX_SHIFT;
+    int32_t screenY = (calibrationMatrix[3] * rawX + calibrationMatrix[4] * rawY + calibrationMatrix[5] + (1L << (TOUCH_MATRIX_SHIFT - 1))) >> TOUCH_MATRIX_SHIFT;
 
-    // Get a weighted Y value
-    *y = ((map(*y, topLeftY, bottomLeftY, 0, LCD_MAX_Y) * *x) + (map(*y, topRightY, bottomRightY, 0, LCD_MAX_Y) * (LCD_MAX_X - *x))) / LCD_WIDTH;
-    *y = constrain(*y, 0, LCD_MAX_Y);
+    // Constrain the values to the screen
+    *x = constrain(screenX, 0, LCD_MAX_X);
+    *y = constrain(screenY, 0, LCD_MAX_Y);
     return true;
 }
 
@@ -37,6 +37,19 @@
 #define TOUCH_PEN_IRQ           ((*portBIn & SETBIT10) == 0)
 
 #define TOUCH_PULSE_CLK         { TOUCH_CLK_IDLE; TOUCH_CLK_ACTIVE; }
+#define TOUCH_PEN_IRQ_PIN       23
+
+// Number of pen-down events that can be queued by the PEN_IRQ interrupt
+#define TOUCH_EVENT_QUEUE_SIZE  8
+
+// Number of accepted readings used to get the median touch position
+#define TOUCH_HISTORY_SIZE      3
+
+// Touch calibration is an affine transform stored as fixed-point numbers:
+//   screenX = (matrix[0] * rawX + matrix[1] * rawY + matrix[2]) >> TOUCH_MATRIX_SHIFT
+//   screenY = (matrix[3] * rawX + matrix[4] * rawY + matrix[5]) >> TOUCH_MATRIX_SHIFT
+#define TOUCH_MATRIX_SIZE       6
+#define TOUCH_MATRIX_SHIFT      16
 
 
 class Controleo3Touch
@@ -46,16 +59,35 @@ class Controleo3Touch
 
 		void begin();
         void calibrate(int16_t,int16_t,int16_t,int16_t,int16_t,int16_t,int16_t,int16_t);
+        bool calibrate(int16_t *rawX, int16_t *rawY, int16_t *screenX, int16_t *screenY, uint8_t num);
+        void setCalibration(int32_t *matrix);
+        void getCalibration(int32_t *matrix);
 		bool read(int16_t *x, int16_t *y);
 		bool readRaw(int16_t *x, int16_t *y);
         bool isPressed();
+        void enableInterrupt();
+        bool available();
+        uint32_t getPenDownTime();
+        uint8_t getSamplesTaken();
 
     private:
   		volatile uint32_t *portAOut, *portAIn, *portAMode, *portBOut, *portBIn, *portBMode;
-        int16_t topLeftX,topRightX,bottomLeftX,bottomRightX,topLeftY,bottomLeftY,topRightY,bottomRightY;
+        int32_t calibrationMatrix[TOUCH_MATRIX_SIZE];
 		void write8(byte data);
 		word read12();
         uint16_t calcDeviation(uint16_t *array, uint8_t num, int16_t *average);
+        int16_t median(int16_t *array, uint8_t num);
+        int16_t historyX[TOUCH_HISTORY_SIZE], historyY[TOUCH_HISTORY_SIZE];
+        uint8_t historyCount, samplesTaken;
+        uint32_t lastHistoryTime;
+        void flushEvents();
+        bool interruptEnabled;
+
+        // Pen-down events, written by the interrupt handler
+        static void penIRQHandler();
+        static volatile uint32_t eventTime[TOUCH_EVENT_QUEUE_SIZE];
+        static volatile uint8_t eventHead, eventTail;
+        static volatile bool isReading;
 };
 
 #endif // CONTROLEO3TOUCH_H_
\ No newline at end of file
@@ -288,6 +288,41 @@ uint32_t const FAT32MASK = 0X0FFFFFFF;
 /** Type name for fat32BootSector */
 typedef struct fat32BootSector fbs_t;
 //------------------------------------------------------------------------------
+/** Value for the leadSignature field of a FAT32 FSInfo sector */
+uint32_t const FSINFO_LEAD_SIG = 0X41615252;
+/** Value for the structSignature field of a FAT32 FSInfo sector */
+uint32_t const FSINFO_STRUCT_SIG = 0X61417272;
+/** Value for the tailSignature field of a FAT32 FSInfo sector */
+uint32_t const FSINFO_TAIL_SIG = 0XAA550000;
+/** Value of freeCount or nextFree when the field is not known */
+uint32_t const FSINFO_UNKNOWN = 0XFFFFFFFF;
+/**
+ * \struct fat32FsInfo
+ *
+ * \brief FSInfo sector for a FAT32 volume.
+ *
+ * The free cluster count and next free cluster are hints.  They may be
+ * wrong if the volume was last written by software that ignores them.
+ */
+struct fat32FsInfo {
+           /** must be 0X41615252 */
+  uint32_t leadSignature;
+           /** should be zero */
+  uint8_t  reserved1[480];
+           /** must be 0X61417272 */
+  uint32_t structSignature;
+           /** last known free cluster count, 0XFFFFFFFF if unknown */
+  uint32_t freeCount;
+           /** cluster to start a free search at, 0XFFFFFFFF if unknown */
+  uint32_t nextFree;
+           /** should be zero */
+  uint8_t  reserved2[12];
+           /** must be 0XAA550000 */
+  uint32_t tailSignature;
+} __attribute__((packed));
+/** Type name for fat32FsInfo */
+typedef struct fat32FsInfo fsinfo_t;
+//------------------------------------------------------------------------------
 /**
  * \struct directoryEntry
  * \brief FAT short directory entry
@@ -15,6 +15,8 @@
 // At full speed, a data bit is clocked out every 800ns.  So 1.25MHz, well below the data rate
 // supported by even the oldest SD cards.  No delays are necessary.  Thank-you oscilloscope!
 // And thank-you 32MB SD card from 2001!
+// Commands use spiRec() and spiSend().  The 512 byte payloads use the faster spiRecBlock() and
+// spiSendBlock(), which only clock the card once it has been initialized.
 
 // SPI receive
 uint8_t Sd2Card::spiRec(void)
@@ -54,9 +56,61 @@ void Sd2Card::spiSend(uint8_t data)
 }
 
 
+// Receive one bit, most significant bit first
+#define SPI_REC_BIT(data)   { FAST_CLK_ACTIVE; data <<= 1; if (MISO_HIGH) data++; FAST_CLK_IDLE; }
+
+// Send one bit (bit 7 of data)
+#define SPI_SEND_BIT(data)  { if (data & 0x80) FAST_MOSI_ACTIVE; else FAST_MOSI_IDLE; FAST_CLK_ACTIVE; data <<= 1; FAST_CLK_IDLE; }
+
+// SPI receive of block data.  The same as spiRec(), but with the bit loop unrolled and
+// the clock driven through the IOBUS.  The card is only clocked this fast once it has been
+// initialized, since initialization must be done at a low clock rate.
+void Sd2Card::spiRecBlock(uint8_t* dst, uint16_t count)
+{
+    // Set the output pin high
+    FAST_MOSI_ACTIVE;
+
+    while (count--) {
+        uint8_t data = 0;
+        SPI_REC_BIT(data);
+        SPI_REC_BIT(data);
+        SPI_REC_BIT(data);
+        SPI_REC_BIT(data);
+        SPI_REC_BIT(data);
+        SPI_REC_BIT(data);
+        SPI_REC_BIT(data);
+        SPI_REC_BIT(data);
+        *dst++ = data;
+    }
+}
+
+
+// SPI send of a 512 byte block of data
+void Sd2Card::spiSendBlock(const uint8_t* src)
+{
+    for (uint16_t i = 0; i < 512; i++) {
+        uint8_t data = src[i];
+        SPI_SEND_BIT(data);
+        SPI_SEND_BIT(data);
+        SPI_SEND_BIT(data);
+        SPI_SEND_BIT(data);
+        SPI_SEND_BIT(data);
+        SPI_SEND_BIT(data);
+        SPI_SEND_BIT(data);
+        SPI_SEND_BIT(data);
+    }
+}
+
+
 // Send command and return error code.  Return zero for OK
 uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg)
 {
+    // Any other command ends a multiple block read or write
+    if (inMultiRead_)
+        readStop();
+    if (inMultiWrite_)
+        writeStop();
+
     // Select card
     CS_ACTIVE;
 
@@ -156,6 +210,10 @@ uint8_t Sd2Card::init()
 {
     boolean retVal = false;
     type_ = 0;
+    inMultiRead_ = false;
+    inMultiWrite_ = false;
+    bytesRead_ = readMicros_ = 0;
+    bytesWritten_ = writeMicros_ = 0;
 
     // Save the port addresses (https://github.com/arduino/ArduinoCore-samd/blob/master/cores/arduino/wiring_digital.c)
     portAOut   = portOutputRegister(digitalPinToPort(2));
@@ -224,6 +282,9 @@ next:
         for (uint8_t i = 0; i < 3; i++)
             spiRec();
     }
+
+    // Find out what the card supports, and switch to high speed mode if possible
+    probeCard();
     retVal = true;
 
 done:
@@ -244,35 +305,112 @@ uint8_t Sd2Card::readData(uint32_t block, uint16_t offset, uint16_t count, uint8
 {
     boolean retVal = false;
     uint16_t offset_;
+    uint32_t startTime = micros();
 
     if (count == 0)
         return true;
     if ((count + offset) > 512)
         return false;
 
-    // Use address if not SDHC card
-    if (type_ != SD_CARD_TYPE_SDHC)
-        block <<= 9;
-    if (cardCommand(CMD17_READ_BLOCK, block)) {
-        DEBUG_PRINT("Sd2Card::readData - read error");
-        goto done;
+    // Is this the next block of a multiple block read?
+    if (isReading(block)) {
+        // The card sends the next block without needing a command
+        CS_ACTIVE;
+        if (!waitStartBlock()) {
+            readStop();
+            return false;
+        }
+        multiReadBlock_++;
+    }
+    else {
+        // Use address if not SDHC card
+        if (type_ != SD_CARD_TYPE_SDHC)
+            block <<= 9;
+        if (cardCommand(CMD17_READ_BLOCK, block)) {
+            DEBUG_PRINT("Sd2Card::readData - read error");
+            goto done;
+        }
+        if (!waitStartBlock())
+            goto done;
     }
-    if (!waitStartBlock())
-        goto done;
 
     // Skip data before offset
     for (offset_ = 0; offset_ < offset; offset_++)
         spiRec();
 
     // Transfer data
-    for (uint16_t i = 0; i < count; i++)
-        dst[i] = spiRec();
+    spiRecBlock(dst, count);
 
     // Read the rest of the block and the CRC
     offset_ += count;
     while (offset_++ < 514)
         spiRec();
 
+    // The whole block is clocked over SPI, however much of it was wanted
+    bytesRead_ += 512;
+    readMicros_ += micros() - startTime;
+    retVal = true;
+
+done:
+    CS_IDLE;
+    return retVal;
+}
+
+
+// Start a multiple block read sequence.  Following calls to readData() for blockNumber,
+// blockNumber+1, ... don't need a command for each block.  Reading any other block, or sending
+// any other command, stops the sequence.
+uint8_t Sd2Card::readStart(uint32_t blockNumber)
+{
+    boolean retVal = false;
+
+    // Use address if not SDHC card
+    uint32_t address = type_ == SD_CARD_TYPE_SDHC? blockNumber: blockNumber << 9;
+    if (cardCommand(CMD18_READ_MULTIPLE_BLOCK, address)) {
+        DEBUG_PRINT("Sd2Card::readStart - error");
+        goto done;
+    }
+    inMultiRead_ = true;
+    multiReadBlock_ = blockNumber;
+    retVal = true;
+
+done:
+    CS_IDLE;
+    return retVal;
+}
+
+
+// End a multiple block read sequence
+uint8_t Sd2Card::readStop(void)
+{
+    boolean retVal = false;
+
+    if (!inMultiRead_)
+        return true;
+    inMultiRead_ = false;
+
+    // Send CMD12 without cardCommand().  The card is still sending the next block, so
+    // waiting for it to stop being busy would just read data
+    CS_ACTIVE;
+    spiSend(CMD12_STOP_TRANSMISSION | 0x40);
+    for (uint8_t i = 0; i < 4; i++)
+        spiSend(0);
+    spiSend(0xFF);
+
+    // The byte after CMD12 is a stuff byte, and may be data.  Then wait for the response
+    spiRec();
+    for (uint8_t i = 0; ((status_ = spiRec()) & 0X80) && i != 0XFF; i++)
+        ;
+    if (status_) {
+        DEBUG_PRINT("Sd2Card::readStop - error");
+        goto done;
+    }
+
+    // The card is busy until it has stopped sending
+    if (!waitNotBusy(SD_READ_TIMEOUT)) {
+        DEBUG_PRINT("Sd2Card::readStop - timeout");
+        goto done;
+    }
     retVal = true;
 
 done:
@@ -284,16 +422,23 @@ done:
 // Read CID or CSR register */
 uint8_t Sd2Card::readRegister(uint8_t cmd, void* buf)
 {
-    boolean retVal = false;
-    uint8_t* dst = reinterpret_cast<uint8_t*>(buf);
     if (cardCommand(cmd, 0)) {
         DEBUG_PRINT("Sd2Card::readRegister - Error reading register");
-        goto done;
+        CS_IDLE;
+        return false;
     }
+    return readDataBlock(reinterpret_cast<uint8_t*>(buf), 16);
+}
+
+
+// Read the data block that follows a command, for registers and status blocks shorter than 512 bytes
+uint8_t Sd2Card::readDataBlock(uint8_t* dst, uint8_t count)
+{
+    boolean retVal = false;
     if (!waitStartBlock())
         goto done;
     // Transfer data
-    for (uint16_t i = 0; i < 16; i++)
+    for (uint8_t i = 0; i < count; i++)
         dst[i] = spiRec();
     spiRec();  // Get crc bytes
     spiRec();
@@ -304,6 +449,79 @@ done:
     return retVal;
 }
 
+
+// Read the SCR register, SD status and CSD register to see what the card supports, and switch the card
+// to high speed mode if it can.  None of this is needed to use the card, so errors are ignored.
+// High speed mode raises the fastest clock the card accepts from 25MHz to 50MHz.
+void Sd2Card::probeCard(void)
+{
+    uint8_t buf[64];
+    csd_t csd;
+    static const uint8_t speedClasses[] = {0, 2, 4, 6, 10};
+
+    sdSpec_ = 0;
+    speedClass_ = 0;
+    highSpeed_ = false;
+    tranSpeed_ = 0;
+
+    // SD_SPEC is the low nibble of the first byte of the SCR
+    if (cardAcmd(ACMD51_SEND_SCR, 0) == R1_READY_STATE && readDataBlock(buf, 8))
+        sdSpec_ = buf[0] & 0x0F;
+
+    // The response to ACMD13 is R2, so skip the second byte.  SPEED_CLASS is byte 8 of the status
+    if (cardAcmd(ACMD13_SD_STATUS, 0) == R1_READY_STATE) {
+        spiRec();
+        if (readDataBlock(buf, 64) && buf[8] < sizeof(speedClasses))
+            speedClass_ = speedClasses[buf[8]];
+    }
+    else
+        CS_IDLE;
+
+    if (!readCSD(&csd))
+        return;
+
+    // Switch functions need SD 1.10 or later, and command class 10 in the CSD
+    if (sdSpec_ >= 1 && (csd.v1.ccc_high & 0x40)) {
+        // Check that high speed (function 1 of group 1) is supported, then switch to it.  The 64 byte
+        // response has the supported functions in byte 13 and the selected function in byte 16
+        if (cardCommand(CMD6_SWITCH_FUNCTION, 0x00FFFFF1) == R1_READY_STATE && readDataBlock(buf, 64) && (buf[13] & 0x02)) {
+            if (cardCommand(CMD6_SWITCH_FUNCTION, 0x80FFFFF1) == R1_READY_STATE && readDataBlock(buf, 64) && (buf[16] & 0x0F) == 1) {
+                highSpeed_ = true;
+                // TRAN_SPEED changes once the card is in high speed mode
+                readCSD(&csd);
+            }
+        }
+        CS_IDLE;
+    }
+    tranSpeed_ = csd.v1.tran_speed;
+}
+
+
+// The fastest clock the card accepts, from TRAN_SPEED in the CSD.  Normally 25MHz, or 50MHz in high speed mode
+uint8_t Sd2Card::maxClockMHz(void)
+{
+    // Time values are multiplied by 10, so these are MHz for the 10Mbit/s unit
+    static const uint8_t timeValue[16] = {0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80};
+    uint8_t value = timeValue[(tranSpeed_ >> 3) & 0x0F];
+
+    switch (tranSpeed_ & 0x07) {
+        case 1: return value / 10;
+        case 2: return value;
+        case 3: return value * 10;
+    }
+    return 0;
+}
+
+
+// Convert bytes transferred in a number of microseconds to KB per second
+uint32_t Sd2Card::kbPerSecond(uint32_t bytes, uint32_t micros)
+{
+    if (!micros)
+        return 0;
+    // 1,000,000 / 1024 = 15625 / 16
+    return (uint64_t) bytes * 15625 / 16 / micros;
+}
+
 // Wait for card to go not busy
 uint8_t Sd2Card::waitNotBusy(uint16_t timeoutMillis)
 {
@@ -344,12 +562,17 @@ uint8_t Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src)
 //    SerialUSB.print("Sd2Card::writeBlock - writing block ");
 //    SerialUSB.println(blockNumber);
     boolean retVal = false;
+    uint32_t startTime = micros();
     // Don't allow write to first block
     if (blockNumber == 0) {
         DEBUG_PRINT("Sd2Card::writeBlock - Can't write to block 0");
         goto done;
     }
 
+    // Is this the next block of a multiple block write?  writeData() measures its own time
+    if (isWriting(blockNumber))
+        return writeData(src);
+
     // Use address if not SDHC card
     if (type() != SD_CARD_TYPE_SDHC)
         blockNumber <<= 9;
@@ -373,6 +596,8 @@ uint8_t Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src)
         DEBUG_PRINT("Sd2Card::writeBlock - Write error");
         goto done;
     }
+    bytesWritten_ += 512;
+    writeMicros_ += micros() - startTime;
     retVal = true;
 
 done:
@@ -384,13 +609,21 @@ done:
 // Write one data block in a multiple block write sequence
 uint8_t Sd2Card::writeData(const uint8_t* src)
 {
+    uint32_t startTime = micros();
+    CS_ACTIVE;
     // Wait for previous write to finish
     if (!waitNotBusy(SD_WRITE_TIMEOUT)) {
         DEBUG_PRINT("Sd2Card::writeData - Write error");
         CS_IDLE;
         return false;
     }
-    return writeData(WRITE_MULTIPLE_TOKEN, src);
+    if (!writeData(WRITE_MULTIPLE_TOKEN, src))
+        return false;
+    multiWriteBlock_++;
+    CS_IDLE;
+    bytesWritten_ += 512;
+    writeMicros_ += micros() - startTime;
+    return true;
 }
 
 
@@ -399,8 +632,7 @@ uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src)
 {
 //    SerialUSB.println("Sd2Card::writeData - writing 512 bytes");
     spiSend(token);
-    for (uint16_t i = 0; i < 512; i++)
-        spiSend(src[i]);
+    spiSendBlock(src);
     spiSend(0xff);  // Dummy crc
     spiSend(0xff);  // Dummy crc
 
@@ -414,14 +646,13 @@ uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src)
 }
 
 
-//  Start a write multiple blocks sequence
+//  Start a write multiple blocks sequence.  The blocks are written with writeData(), or with
+//  writeBlock() for blockNumber, blockNumber+1, ...  The card pre-erases eraseCount blocks,
+//  so these must all belong to the file being written.
 uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount)
 {
-    SerialUSB.print("Sd2Card::writeStart - writing block ");
-    SerialUSB.print(blockNumber);
-    SerialUSB.print(" eraseCount=");
-    SerialUSB.println(eraseCount);
     boolean retVal = false;
+    uint32_t address = blockNumber;
     // Don't allow write to first block
     if (blockNumber == 0) {
         DEBUG_PRINT("Sd2Card::writeStart - Can't write block 0");
@@ -434,13 +665,14 @@ uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount)
     }
     // Use address if not SDHC card
     if (type() != SD_CARD_TYPE_SDHC)
-        blockNumber <<= 9;
-    if (cardCommand(CMD25_WRITE_MULTIPLE_BLOCK, blockNumber)) {
+        address <<= 9;
+    if (cardCommand(CMD25_WRITE_MULTIPLE_BLOCK, address)) {
         DEBUG_PRINT("Sd2Card::writeStart - error");
         goto done;
     }
-    // Keep CS low
-    return true;
+    inMultiWrite_ = true;
+    multiWriteBlock_ = blockNumber;
+    retVal = true;
 
 done:
     CS_IDLE;
@@ -451,8 +683,11 @@ done:
 // End a write multiple blocks sequence
 uint8_t Sd2Card::writeStop(void)
 {
-    SerialUSB.print("Sd2Card::writeStop - writing block ");
     boolean retVal = false;
+    if (!inMultiWrite_)
+        return true;
+    inMultiWrite_ = false;
+    CS_ACTIVE;
     if (!waitNotBusy(SD_WRITE_TIMEOUT))
         goto done;
     spiSend(STOP_TRAN_TOKEN);
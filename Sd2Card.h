@@ -30,6 +30,15 @@
 #define MISO_IDLE		(*portAOut &= CLEARBIT04)
 #define MISO_HIGH  		(*portAIn & SETBIT04)
 
+// The SD card pins (PA04-PA07) can't be mapped to a SERCOM in SPI mode; SCK would need to be
+// on PAD1 or PAD3 with MOSI on PAD0 or PAD3.  Block payloads are instead bit-banged through the
+// single-cycle IOBUS OUTSET/OUTCLR registers.  These don't read-modify-write port A, so they
+// can't undo pin changes made by an interrupt.
+#define FAST_CLK_ACTIVE (PORT_IOBUS->Group[0].OUTSET.reg = SETBIT05)
+#define FAST_CLK_IDLE   (PORT_IOBUS->Group[0].OUTCLR.reg = SETBIT05)
+#define FAST_MOSI_ACTIVE (PORT_IOBUS->Group[0].OUTSET.reg = SETBIT06)
+#define FAST_MOSI_IDLE  (PORT_IOBUS->Group[0].OUTCLR.reg = SETBIT06)
+
 
 #define SD_INIT_TIMEOUT                 2000    // Init timeout ms
 #define SD_ERASE_TIMEOUT                10000   // Erase timeout ms
@@ -51,6 +60,12 @@ public:
     uint8_t init(void);
     uint8_t readBlock(uint32_t block, uint8_t* dst);
     uint8_t readData(uint32_t block, uint16_t offset, uint16_t count, uint8_t* dst);
+    uint8_t readStart(uint32_t blockNumber);
+    uint8_t readStop(void);
+    // True if a multiple block read is in progress, and the next block it will return is "block"
+    uint8_t isReading(uint32_t block) { return inMultiRead_ && block == multiReadBlock_; }
+    // True if a multiple block write is in progress, and the next block it will write is "block"
+    uint8_t isWriting(uint32_t block) { return inMultiWrite_ && block == multiWriteBlock_; }
     // Read a cards CID register. The CID contains card identification information such as Manufacturer ID,
     // Product name, Product serial number and Manufacturing date.
     uint8_t readCID(cid_t* cid) { return readRegister(CMD10_SEND_CID, cid); }
@@ -58,6 +73,16 @@ public:
     // regarding access to the card's contents.
     uint8_t readCSD(csd_t* csd) { return readRegister(CMD9_SEND_CSD, csd); }
     uint8_t type(void)  { return type_; }
+    // What the card supports, found by init().  The SD specification version is from the SCR register
+    // (0 = 1.0, 1 = 1.10, 2 = 2.0 or later), and the speed class (0, 2, 4, 6 or 10) is from the SD status
+    uint8_t sdSpec(void) { return sdSpec_; }
+    uint8_t speedClass(void) { return speedClass_; }
+    // True if the card was switched to high speed mode (CMD6)
+    uint8_t isHighSpeed(void) { return highSpeed_; }
+    uint8_t maxClockMHz(void);
+    // Measured throughput of block reads and writes since init(), in KB per second
+    uint32_t readKBPerSecond(void) { return kbPerSecond(bytesRead_, readMicros_); }
+    uint32_t writeKBPerSecond(void) { return kbPerSecond(bytesWritten_, writeMicros_); }
     uint8_t writeBlock(uint32_t blockNumber, const uint8_t* src);
     uint8_t writeData(const uint8_t* src);
     uint8_t writeData(uint8_t token, const uint8_t* src);
@@ -68,12 +93,29 @@ private:
     volatile uint32_t *portAOut, *portAIn, *portAMode;
     uint8_t status_;
     uint8_t type_;
+    uint8_t inMultiRead_;           // A multiple block read (CMD18) is in progress
+    uint32_t multiReadBlock_;       // The next block the multiple block read will return
+    uint8_t inMultiWrite_;          // A multiple block write (CMD25) is in progress
+    uint32_t multiWriteBlock_;      // The next block the multiple block write will write
+    uint8_t sdSpec_;                // SD_SPEC field of the SCR register
+    uint8_t speedClass_;            // Speed class from the SD status
+    uint8_t highSpeed_;             // The card was switched to high speed mode
+    uint8_t tranSpeed_;             // TRAN_SPEED field of the CSD register
+    uint32_t bytesRead_;            // Bytes clocked in whole blocks, and the time taken (microseconds)
+    uint32_t readMicros_;
+    uint32_t bytesWritten_;         // Bytes written, and the time taken (microseconds)
+    uint32_t writeMicros_;
     uint8_t cardAcmd(uint8_t cmd, uint32_t arg) { cardCommand(CMD55_APP_CMD, 0); return cardCommand(cmd, arg); }
     uint8_t cardCommand(uint8_t cmd, uint32_t arg);
+    static uint32_t kbPerSecond(uint32_t bytes, uint32_t micros);
+    void    probeCard(void);
+    uint8_t readDataBlock(uint8_t* dst, uint8_t count);
     uint8_t readRegister(uint8_t cmd, void* buf);
     uint8_t waitNotBusy(uint16_t timeoutMillis);
     uint8_t waitStartBlock(void);
     uint8_t spiRec(void);
     void    spiSend(uint8_t data);
+    void    spiRecBlock(uint8_t* dst, uint16_t count);
+    void    spiSendBlock(const uint8_t* src);
 };
 #endif  // SD2CARD_H_
@@ -129,6 +129,8 @@ static inline uint8_t FAT_SECOND(uint16_t fatTime) {
 uint16_t const FAT_DEFAULT_DATE = ((2000 - 1980) << 9) | (1 << 5) | 1;
 /** Default time for file timestamp is 1 am */
 uint16_t const FAT_DEFAULT_TIME = (1 << 11);
+/** Number of contiguous cluster runs an open file keeps in its extent map */
+uint8_t const FILE_EXTENT_COUNT = 4;
 //------------------------------------------------------------------------------
 /**
  * \class SdFile
@@ -155,6 +157,8 @@ class SdFile : public Print {
   uint8_t contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock);
   uint8_t createContiguous(SdFile* dirFile,
           const char* fileName, uint32_t size);
+  uint8_t createPreallocated(SdFile* dirFile,
+          const char* fileName, uint32_t size);
   /** \return The current cluster number for a file or directory. */
   uint32_t curCluster(void) const {return curCluster_;}
   /** \return The current position for a file or directory. */
@@ -216,6 +220,8 @@ class SdFile : public Print {
   uint8_t isOpen(void) const {return type_ != FAT_FILE_TYPE_CLOSED;}
   /** \return True if this is a SdFile for a subdirectory else false. */
   uint8_t isSubDir(void) const {return type_ == FAT_FILE_TYPE_SUBDIR;}
+  /** \return True if this SdFile was opened for writing else false. */
+  uint8_t isWritable(void) const {return flags_ & O_WRITE;}
   /** \return True if this is a SdFile for the root directory. */
   uint8_t isRoot(void) const {
     return type_ == FAT_FILE_TYPE_ROOT16 || type_ == FAT_FILE_TYPE_ROOT32;
@@ -246,7 +252,7 @@ class SdFile : public Print {
   uint8_t remove(void);
   /** Set the file's current position to zero. */
   void rewind(void) {
-    curPosition_ = curCluster_ = 0;
+    curPosition_ = curCluster_ = runEndCluster_ = 0;
   }
   uint8_t rmDir(void);
   uint8_t rmRfStar(void);
@@ -373,14 +379,17 @@ class SdFile : public Print {
   // should be 0XF
   static uint8_t const F_OFLAG = (O_ACCMODE | O_APPEND | O_SYNC);
   // available bits
-  static uint8_t const F_UNUSED = 0X30;
+  static uint8_t const F_UNUSED = 0X20;
+  // clusters were allocated by createPreallocated(), trim them on close
+  static uint8_t const F_FILE_PREALLOCATED = 0X10;
   // use unbuffered SD read
   static uint8_t const F_FILE_UNBUFFERED_READ = 0X40;
   // sync of directory entry required
   static uint8_t const F_FILE_DIR_DIRTY = 0X80;
 
 // make sure F_OFLAG is ok
-#if ((F_UNUSED | F_FILE_UNBUFFERED_READ | F_FILE_DIR_DIRTY) & F_OFLAG)
+#if ((F_UNUSED | F_FILE_PREALLOCATED | F_FILE_UNBUFFERED_READ |\
+  F_FILE_DIR_DIRTY) & F_OFLAG)
 #error flags_ bits conflict
 #endif  // flags_ bits
 
@@ -393,7 +402,13 @@ class SdFile : public Print {
   uint8_t   dirIndex_;      // index of entry in dirBlock 0 <= dirIndex_ <= 0XF
   uint32_t  fileSize_;      // file size in bytes
   uint32_t  firstCluster_;  // first cluster of file
+  uint32_t  runEndCluster_; // last cluster of the run with curCluster_, or 0
   SdVolume* vol_;           // volume where file is located
+  // extent map - the first clusters and lengths of the file's cluster runs
+  uint32_t  extentCluster_[FILE_EXTENT_COUNT];
+  uint32_t  extentLength_[FILE_EXTENT_COUNT];
+  uint8_t   extentCount_;     // number of runs in the extent map
+  uint8_t   extentComplete_;  // true if the map covers the whole chain
 
   // private functions
   uint8_t addCluster(void);
@@ -401,8 +416,12 @@ class SdFile : public Print {
   dir_t* cacheDirEntry(uint8_t action);
   static void (*dateTime_)(uint16_t* date, uint16_t* time);
   static uint8_t make83Name(const char* str, uint8_t* name);
+  uint8_t mapCluster(uint32_t index, uint32_t* cluster,
+                     uint32_t* runEnd) const;
+  uint8_t mapExtents(void);
   uint8_t openCachedEntry(uint8_t cacheIndex, uint8_t oflags);
   dir_t* readDirCache(void);
+  uint8_t readStart(uint32_t block);
 };
 //==============================================================================
 // SdVolume class
@@ -422,6 +441,30 @@ union cache_t {
   mbr_t    mbr;
            /** Used to access to a cached FAT boot sector. */
   fbs_t    fbs;
+           /** Used to access a cached FAT32 FSInfo sector. */
+  fsinfo_t fsinfo;
+};
+//------------------------------------------------------------------------------
+/** Number of cache slots reserved for FAT and directory blocks */
+uint8_t const CACHE_META_SLOTS = 2;
+/** Number of cache slots used for file data blocks */
+uint8_t const CACHE_DATA_SLOTS = 2;
+/** Total number of 512 byte cache slots */
+uint8_t const CACHE_SLOTS = CACHE_META_SLOTS + CACHE_DATA_SLOTS;
+/**
+ * \brief A slot in the SdVolume block cache
+ */
+struct cacheSlot_t {
+           /** The cached block. */
+  cache_t  buffer;
+           /** Logical block number in the slot, 0XFFFFFFFF if empty. */
+  uint32_t blockNumber;
+           /** Block number for mirror FAT, zero if none. */
+  uint32_t mirrorBlock;
+           /** Value of the use counter the last time the slot was accessed. */
+  uint32_t lastUsed;
+           /** cacheFlush() will write block if true. */
+  uint8_t  dirty;
 };
 //------------------------------------------------------------------------------
 /**
@@ -431,15 +474,23 @@ union cache_t {
 class SdVolume {
  public:
   /** Create an instance of SdVolume */
-  SdVolume(void) :allocSearchStart_(2), fatType_(0) {}
+  SdVolume(void) :allocSearchStart_(2), freeClusterCount_(FSINFO_UNKNOWN),
+    freeCountIsHint_(false), fsInfoBlock_(0), fsInfoDirty_(false),
+    fatType_(0) {}
   /** Clear the cache and returns a pointer to the cache.  Used by the WaveRP
    *  recorder to do raw write to the SD card.  Not for normal apps.
    */
   static uint8_t* cacheClear(void) {
     cacheFlush();
-    cacheBlockNumber_ = 0XFFFFFFFF;
-    return cacheBuffer_.data;
+    cacheSlot_[cacheCurrent_].blockNumber = 0XFFFFFFFF;
+    return cacheBuffer_->data;
   }
+  /** \return The number of block lookups satisfied by the cache. */
+  static uint32_t cacheHits(void) {return cacheHits_;}
+  /** \return The number of block lookups that had to read the card. */
+  static uint32_t cacheMisses(void) {return cacheMisses_;}
+  /** Reset the cache hit and miss counters. */
+  static void cacheResetStats(void) {cacheHits_ = cacheMisses_ = 0;}
   /**
    * Initialize a FAT volume.  Try partition one first then try super
    * floppy format.
@@ -471,6 +522,8 @@ class SdVolume {
   uint32_t fatStartBlock(void) const {return fatStartBlock_;}
   /** \return The FAT type of the volume. Values are 12, 16 or 32. */
   uint8_t fatType(void) const {return fatType_;}
+  int32_t freeClusterCount(void);
+  uint8_t fsInfoSync(void);
   /** \return The number of entries in the root directory for FAT16 volumes. */
   uint32_t rootDirEntryCount(void) const {return rootDirEntryCount_;}
   /** \return The logical block number for the start of the root directory
@@ -498,12 +551,18 @@ class SdVolume {
   static uint8_t const CACHE_FOR_READ = 0;
   // value for action argument in cacheRawBlock to indicate cache dirty
   static uint8_t const CACHE_FOR_WRITE = 1;
+  // value for pool argument in cacheRawBlock for FAT and directory blocks
+  static uint8_t const CACHE_POOL_META = 0;
+  // value for pool argument in cacheRawBlock for file data blocks
+  static uint8_t const CACHE_POOL_DATA = 1;
 
-  static cache_t cacheBuffer_;        // 512 byte cache for device blocks
-  static uint32_t cacheBlockNumber_;  // Logical number of block in the cache
+  static cacheSlot_t cacheSlot_[CACHE_SLOTS];  // 512 byte caches for blocks
+  static uint8_t cacheCurrent_;       // slot of most recently used block
+  static cache_t* cacheBuffer_;       // buffer of most recently used block
+  static uint32_t cacheUseCount_;     // advanced on every access for LRU
+  static uint32_t cacheHits_;         // lookups found in the cache
+  static uint32_t cacheMisses_;       // lookups that read the card
   static Sd2Card* sdCard_;            // Sd2Card object for cache
-  static uint8_t cacheDirty_;         // cacheFlush() will write block if true
-  static uint32_t cacheMirrorBlock_;  // block number for mirror FAT
 //
   uint32_t allocSearchStart_;   // start cluster for alloc search
   uint8_t blocksPerCluster_;    // cluster size in blocks
@@ -513,6 +572,10 @@ class SdVolume {
   uint32_t dataStartBlock_;     // first data block number
   uint8_t fatCount_;            // number of FATs on volume
   uint32_t fatStartBlock_;      // start block for first FAT
+  uint32_t freeClusterCount_;   // free clusters, FSINFO_UNKNOWN until counted
+  uint8_t freeCountIsHint_;     // freeClusterCount_ is FSInfo's, not counted
+  uint32_t fsInfoBlock_;        // FAT32 FSInfo block, zero if none
+  uint8_t fsInfoDirty_;         // fsInfoSync() will write FSInfo if true
   uint8_t fatType_;             // volume type (12, 16, OR 32)
   uint16_t rootDirEntryCount_;  // number of entries in FAT16 root dir
   uint32_t rootDirStart_;       // root start block for FAT16, cluster for FAT32
@@ -524,9 +587,23 @@ class SdVolume {
            return dataStartBlock_ + ((cluster - 2) << clusterSizeShift_);}
   uint32_t blockNumber(uint32_t cluster, uint32_t position) const {
            return clusterStartBlock(cluster) + blockOfCluster(position);}
+  static uint32_t cacheBlockNumber(void) {
+    return cacheSlot_[cacheCurrent_].blockNumber;}
+  static int8_t cacheFind(uint32_t blockNumber);
   static uint8_t cacheFlush(void);
-  static uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action);
-  static void cacheSetDirty(void) {cacheDirty_ |= CACHE_FOR_WRITE;}
+  static uint8_t cacheFlushBlock(uint32_t blockNumber);
+  static uint8_t cacheFlushSlot(uint8_t slot);
+  static void cacheInvalidate(uint32_t blockNumber);
+  static void cacheInvalidateAll(void);
+  static uint8_t cacheNewBlock(uint32_t blockNumber, uint8_t pool);
+  static uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action) {
+    return cacheRawBlock(blockNumber, action, CACHE_POOL_DATA);}
+  static uint8_t cacheRawBlock(uint32_t blockNumber,
+                               uint8_t action, uint8_t pool);
+  static void cacheSetDirty(void) {
+    cacheSlot_[cacheCurrent_].dirty |= CACHE_FOR_WRITE;}
+  static void cacheUse(uint8_t slot);
+  static int8_t cacheVictim(uint8_t pool);
   static uint8_t cacheZeroBlock(uint32_t blockNumber);
   uint8_t chainSize(uint32_t beginCluster, uint32_t* size) const;
   uint8_t fatGet(uint32_t cluster, uint32_t* value) const;
@@ -535,6 +612,7 @@ class SdVolume {
     return fatPut(cluster, 0x0FFFFFFF);
   }
   uint8_t freeChain(uint32_t cluster);
+  uint8_t fsInfoInit(void);
   uint8_t isEOC(uint32_t cluster) const {
     return  cluster >= (fatType_ == 16 ? FAT16EOC_MIN : FAT32EOC_MIN);
   }
@@ -544,8 +622,26 @@ class SdVolume {
     uint16_t count, uint8_t* dst) {
       return sdCard_->readData(block, offset, count, dst);
   }
+  uint8_t readStart(uint32_t block) {
+    return sdCard_->readStart(block);
+  }
+  uint8_t readStop(void) {
+    return sdCard_->readStop();
+  }
+  uint8_t isReading(uint32_t block) const {
+    return sdCard_->isReading(block);
+  }
   uint8_t writeBlock(uint32_t block, const uint8_t* dst) {
     return sdCard_->writeBlock(block, dst);
   }
+  uint8_t writeStart(uint32_t block, uint32_t eraseCount) {
+    return sdCard_->writeStart(block, eraseCount);
+  }
+  static uint8_t writeStop(void) {
+    return sdCard_->writeStop();
+  }
+  uint8_t isWriting(uint32_t block) const {
+    return sdCard_->isWriting(block);
+  }
 };
 #endif  // SdFat_h
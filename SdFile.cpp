@@ -40,6 +40,19 @@ uint8_t SdFile::addCluster() {
     firstCluster_ = curCluster_;
     flags_ |= F_FILE_DIR_DIRTY;
   }
+  // keep the extent map complete if it was
+  if (extentComplete_) {
+    uint8_t i = extentCount_ - 1;
+    if (extentCount_ &&
+      (extentCluster_[i] + extentLength_[i]) == curCluster_) {
+      extentLength_[i]++;
+    } else if (extentCount_ < FILE_EXTENT_COUNT) {
+      extentCluster_[extentCount_] = curCluster_;
+      extentLength_[extentCount_++] = 1;
+    } else {
+      extentComplete_ = false;
+    }
+  }
   return true;
 }
 //------------------------------------------------------------------------------
@@ -61,8 +74,10 @@ uint8_t SdFile::addDirCluster(void) {
 // cache a file's directory entry
 // return pointer to cached entry or null for failure
 dir_t* SdFile::cacheDirEntry(uint8_t action) {
-  if (!SdVolume::cacheRawBlock(dirBlock_, action)) return NULL;
-  return SdVolume::cacheBuffer_.dir + dirIndex_;
+  if (!SdVolume::cacheRawBlock(dirBlock_, action, SdVolume::CACHE_POOL_META)) {
+    return NULL;
+  }
+  return SdVolume::cacheBuffer_->dir + dirIndex_;
 }
 //------------------------------------------------------------------------------
 /**
@@ -74,7 +89,13 @@ dir_t* SdFile::cacheDirEntry(uint8_t action) {
  * Reasons for failure include no file is open or an I/O error.
  */
 uint8_t SdFile::close(void) {
+  // give back the clusters a preallocated file didn't use
+  if (flags_ & F_FILE_PREALLOCATED) {
+    flags_ &= ~F_FILE_PREALLOCATED;
+    if (!truncate(fileSize_)) return false;
+  }
   if (!sync())return false;
+  vol_->readStop();
   type_ = FAT_FILE_TYPE_CLOSED;
   return true;
 }
@@ -94,6 +115,14 @@ uint8_t SdFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock) {
   // error if no blocks
   if (firstCluster_ == 0) return false;
 
+  // the extent map knows if the whole chain is one run
+  if (extentComplete_) {
+    if (extentCount_ != 1) return false;
+    *bgnBlock = vol_->clusterStartBlock(firstCluster_);
+    *endBlock = vol_->clusterStartBlock(firstCluster_ + extentLength_[0] - 1)
+                + vol_->blocksPerCluster_ - 1;
+    return true;
+  }
   for (uint32_t c = firstCluster_; ; c++) {
     uint32_t next;
     if (!vol_->fatGet(c, &next)) return false;
@@ -143,12 +172,41 @@ uint8_t SdFile::createContiguous(SdFile* dirFile,
     return false;
   }
   fileSize_ = size;
+  if (!mapExtents()) return false;
 
   // insure sync() will update dir entry
   flags_ |= F_FILE_DIR_DIRTY;
   return sync();
 }
 //------------------------------------------------------------------------------
+/**
+ * Create and open a new contiguous file for logging.
+ *
+ * The clusters for \a size bytes are allocated as with createContiguous()
+ * but the file starts empty.  Until the file grows past \a size, write()
+ * and sync() only write data blocks; the FAT and directory entry are not
+ * touched.  close() trims the file to the length written and frees the
+ * unused clusters.  If the file is not closed the directory entry keeps
+ * the preallocated size.
+ *
+ * \param[in] dirFile The directory where the file will be created.
+ * \param[in] fileName A valid DOS 8.3 file name.
+ * \param[in] size The number of bytes to allocate.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure are the same as for createContiguous().
+ */
+uint8_t SdFile::createPreallocated(SdFile* dirFile,
+        const char* fileName, uint32_t size) {
+  if (!createContiguous(dirFile, fileName, size)) return false;
+
+  // the extent map still covers all the allocated clusters
+  fileSize_ = 0;
+  flags_ |= F_FILE_PREALLOCATED;
+  return true;
+}
+//------------------------------------------------------------------------------
 /**
  * Return a files directory entry
  *
@@ -319,10 +377,12 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
 
   // cache block for '.'  and '..'
   uint32_t block = vol_->clusterStartBlock(firstCluster_);
-  if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) return false;
-
+  if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE,
+                               SdVolume::CACHE_POOL_META)) {
+    return false;
+  }
   // copy '.' to block
-  memcpy(&SdVolume::cacheBuffer_.dir[0], &d, sizeof(d));
+  memcpy(&SdVolume::cacheBuffer_->dir[0], &d, sizeof(d));
 
   // make entry for '..'
   d.name[1] = '.';
@@ -334,7 +394,7 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
     d.firstClusterHigh = dir->firstCluster_ >> 16;
   }
   // copy '..' to block
-  memcpy(&SdVolume::cacheBuffer_.dir[1], &d, sizeof(d));
+  memcpy(&SdVolume::cacheBuffer_->dir[1], &d, sizeof(d));
 
   // set position after '..'
   curPosition_ = 2 * sizeof(d);
@@ -343,6 +403,56 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
   return SdVolume::cacheFlush();
 }
 //------------------------------------------------------------------------------
+// find the cluster at index in the file with the extent map.  runEnd is
+// set to the last cluster of its run.  return false if the map doesn't
+// reach index
+uint8_t SdFile::mapCluster(uint32_t index, uint32_t* cluster,
+                           uint32_t* runEnd) const {
+  for (uint8_t i = 0; i < extentCount_; i++) {
+    if (index < extentLength_[i]) {
+      *cluster = extentCluster_[i] + index;
+      *runEnd = extentCluster_[i] + extentLength_[i] - 1;
+      return true;
+    }
+    index -= extentLength_[i];
+  }
+  return false;
+}
+//------------------------------------------------------------------------------
+// follow the FAT once to build the extent map for a file.  Only the
+// clusters holding file data and the first FILE_EXTENT_COUNT runs are
+// mapped; positions past the map follow the FAT as before
+uint8_t SdFile::mapExtents(void) {
+  extentCount_ = 0;
+  extentComplete_ = isFile();
+  if (!extentComplete_ || firstCluster_ == 0) return true;
+
+  // clusters that hold file data, at least one
+  uint32_t n = fileSize_ ? (fileSize_ - 1) >> (vol_->clusterSizeShift_ + 9) : 0;
+  uint32_t c = firstCluster_;
+  extentCluster_[0] = c;
+  extentLength_[0] = 1;
+  extentCount_ = 1;
+  while (1) {
+    uint32_t next;
+    if (!vol_->fatGet(c, &next)) return false;
+    if (vol_->isEOC(next)) return true;
+    if (n-- == 0) break;
+    if (next == (c + 1)) {
+      extentLength_[extentCount_ - 1]++;
+    } else if (extentCount_ < FILE_EXTENT_COUNT) {
+      extentCluster_[extentCount_] = next;
+      extentLength_[extentCount_++] = 1;
+    } else {
+      break;
+    }
+    c = next;
+  }
+  // chain continues past the map
+  extentComplete_ = false;
+  return true;
+}
+//------------------------------------------------------------------------------
 /**
  * Open a file or directory by name.
  *
@@ -414,7 +524,7 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
       if (!emptyFound) {
         emptyFound = true;
         dirIndex_ = index;
-        dirBlock_ = SdVolume::cacheBlockNumber_;
+        dirBlock_ = SdVolume::cacheBlockNumber();
       }
       // done if no entries follow
       if (p->name[0] == DIR_NAME_FREE) break;
@@ -441,7 +551,7 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
 
     // use first entry in cluster
     dirIndex_ = 0;
-    p = SdVolume::cacheBuffer_.dir;
+    p = SdVolume::cacheBuffer_->dir;
   }
   // initialize as empty file
   memset(p, 0, sizeof(dir_t));
@@ -519,7 +629,7 @@ SerialUSB.println("SdFile::open:9");
 // open a cached directory entry. Assumes vol_ is initializes
 uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // location of entry in cache
-  dir_t* p = SdVolume::cacheBuffer_.dir + dirIndex;
+  dir_t* p = SdVolume::cacheBuffer_->dir + dirIndex;
 
   // write or truncate is an error for a directory or read-only file
   if (p->attributes & (DIR_ATT_READ_ONLY | DIR_ATT_DIRECTORY)) {
@@ -527,7 +637,7 @@ uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   }
   // remember location of directory entry on SD
   dirIndex_ = dirIndex;
-  dirBlock_ = SdVolume::cacheBlockNumber_;
+  dirBlock_ = SdVolume::cacheBlockNumber();
 
   // copy first cluster number for directory fields
   firstCluster_ = (uint32_t)p->firstClusterHigh << 16;
@@ -549,6 +659,10 @@ uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+  runEndCluster_ = 0;
+
+  // map the file's clusters so reads and seeks don't need the FAT
+  if (!mapExtents()) return false;
 
   // truncate file to zero length if requested
   if (oflag & O_TRUNC) return truncate(0);
@@ -588,6 +702,11 @@ uint8_t SdFile::openRoot(SdVolume* vol) {
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+  runEndCluster_ = 0;
+
+  // directories follow the FAT
+  extentCount_ = 0;
+  extentComplete_ = false;
 
   // root has no directory entry
   dirBlock_ = 0;
@@ -698,12 +817,24 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
         if (curPosition_ == 0) {
           // use first cluster in file
           curCluster_ = firstCluster_;
-        } else {
-          // get next cluster from FAT
+          runEndCluster_ = 0;
+        } else if (curCluster_ < runEndCluster_) {
+          // still in a contiguous run, no need to read the FAT
+          curCluster_++;
+        } else if (!mapCluster(curPosition_ >> (vol_->clusterSizeShift_ + 9),
+                               &curCluster_, &runEndCluster_)) {
+          // not in the extent map - get next cluster from FAT
           if (!vol_->fatGet(curCluster_, &curCluster_)) return -1;
+          runEndCluster_ = 0;
         }
       }
       block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
+
+      // stream sequential file reads with a multiple block read
+      if (isFile() && SdVolume::cacheFind(block) < 0 &&
+        !vol_->isReading(block)) {
+        if (!readStart(block)) return -1;
+      }
     }
     uint16_t n = toRead;
 
@@ -711,14 +842,18 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
     if (n > (512 - offset)) n = 512 - offset;
 
     // no buffering needed if n == 512 or user requests no buffering
-    if ((unbufferedRead() || n == 512) &&
-      block != SdVolume::cacheBlockNumber_) {
+    if ((unbufferedRead() || n == 512) && SdVolume::cacheFind(block) < 0) {
       if (!vol_->readData(block, offset, n, dst)) return -1;
       dst += n;
     } else {
-      // read block to cache and copy data to caller
-      if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) return -1;
-      uint8_t* src = SdVolume::cacheBuffer_.data + offset;
+      // read block to cache and copy data to caller.  Directory blocks
+      // use their own slots so file data doesn't evict them
+      uint8_t pool = isFile() ? SdVolume::CACHE_POOL_DATA
+                              : SdVolume::CACHE_POOL_META;
+      if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_READ, pool)) {
+        return -1;
+      }
+      uint8_t* src = SdVolume::cacheBuffer_->data + offset;
       uint8_t* end = src + n;
       while (src != end) *dst++ = *src++;
     }
@@ -728,6 +863,36 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
   return nbyte;
 }
 //------------------------------------------------------------------------------
+// Start a multiple block read at block if the following blocks are also in
+// the file.  The FAT is followed once to find the end of the contiguous run
+// of clusters, so the run can be read without looking at the FAT again.
+uint8_t SdFile::readStart(uint32_t block) {
+  uint8_t shift = vol_->clusterSizeShift_ + 9;
+
+  // nothing to stream if this is the last block of the file
+  if ((curPosition_ >> 9) >= ((fileSize_ - 1) >> 9)) return true;
+
+  // find the end of the contiguous run, but not past the end of the file
+  uint32_t cluster;
+  if (runEndCluster_ < curCluster_ &&
+    !mapCluster(curPosition_ >> shift, &cluster, &runEndCluster_)) {
+    uint32_t n = ((fileSize_ - 1) >> shift) - (curPosition_ >> shift);
+    runEndCluster_ = curCluster_;
+    while (n--) {
+      uint32_t next;
+      if (!vol_->fatGet(runEndCluster_, &next)) return false;
+      if (next != (runEndCluster_ + 1)) break;
+      runEndCluster_ = next;
+    }
+  }
+  // is the next block contiguous?
+  if (vol_->blockOfCluster(curPosition_) == (vol_->blocksPerCluster_ - 1) &&
+    runEndCluster_ == curCluster_) {
+    return true;
+  }
+  return vol_->readStart(block);
+}
+//------------------------------------------------------------------------------
 /**
  * Read the next directory entry from a directory file.
  *
@@ -772,7 +937,7 @@ dir_t* SdFile::readDirCache(void) {
   curPosition_ += 31;
 
   // return pointer to entry
-  return (SdVolume::cacheBuffer_.dir + i);
+  return (SdVolume::cacheBuffer_->dir + i);
 }
 //------------------------------------------------------------------------------
 /**
@@ -935,6 +1100,10 @@ uint8_t SdFile::seekSet(uint32_t pos) {
   // error if file not open or seek past end of file
   if (!isOpen() || pos > fileSize_) return false;
 
+  // end any multiple block read, the run will be found again by read()
+  vol_->readStop();
+  runEndCluster_ = 0;
+
   if (type_ == FAT_FILE_TYPE_ROOT16) {
     curPosition_ = pos;
     return true;
@@ -949,6 +1118,12 @@ uint8_t SdFile::seekSet(uint32_t pos) {
   uint32_t nCur = (curPosition_ - 1) >> (vol_->clusterSizeShift_ + 9);
   uint32_t nNew = (pos - 1) >> (vol_->clusterSizeShift_ + 9);
 
+  // no need to follow the chain if the extent map reaches the position
+  if (mapCluster(nNew, &curCluster_, &runEndCluster_)) {
+    curPosition_ = pos;
+    return true;
+  }
+
   if (nNew < nCur || curPosition_ == 0) {
     // must follow chain from first cluster
     curCluster_ = firstCluster_;
@@ -995,7 +1170,13 @@ uint8_t SdFile::sync(void) {
     // clear directory dirty
     flags_ &= ~F_FILE_DIR_DIRTY;
   }
-  return SdVolume::cacheFlush();
+  // update FAT32 FSInfo if clusters were allocated or freed
+  if (!vol_->fsInfoSync()) return false;
+
+  if (!SdVolume::cacheFlush()) return false;
+
+  // finish any multiple block write so the data is on the card
+  return SdVolume::writeStop();
 }
 //------------------------------------------------------------------------------
 /**
@@ -1087,8 +1268,9 @@ uint8_t SdFile::truncate(uint32_t length) {
   // error if length is greater than current size
   if (length > fileSize_) return false;
 
-  // fileSize and length are zero - nothing to do
-  if (fileSize_ == 0) return true;
+  // fileSize and length are zero - nothing to do unless clusters
+  // were preallocated
+  if (fileSize_ == 0 && firstCluster_ == 0) return true;
 
   // remember position for seek after truncation
   uint32_t newPos = curPosition_ > length ? length : curPosition_;
@@ -1114,6 +1296,9 @@ uint8_t SdFile::truncate(uint32_t length) {
   }
   fileSize_ = length;
 
+  // freed clusters may have been in the extent map
+  if (!mapExtents()) return false;
+
   // need to update directory entry
   flags_ |= F_FILE_DIR_DIRTY;
 
@@ -1148,9 +1333,15 @@ size_t SdFile::write(const void* buf, uint16_t nbyte) {
   // number of bytes left to write  -  must be before goto statements
   uint16_t nToWrite = nbyte;
 
+  // end of an extent map run, not used by write
+  uint32_t runEnd;
+
   // error if not a normal file or is read-only
   if (!isFile() || !(flags_ & O_WRITE)) goto writeErrorReturn;
 
+  // writing may move curCluster_ outside the contiguous run found by read()
+  runEndCluster_ = 0;
+
   // seek to end of file if append flag
   if ((flags_ & O_APPEND) && curPosition_ != fileSize_) {
     if (!seekEnd()) goto writeErrorReturn;
@@ -1168,7 +1359,9 @@ size_t SdFile::write(const void* buf, uint16_t nbyte) {
         } else {
           curCluster_ = firstCluster_;
         }
-      } else {
+      } else if (!mapCluster(curPosition_ >> (vol_->clusterSizeShift_ + 9),
+                             &curCluster_, &runEnd)) {
+        // not in the extent map - get next cluster from FAT
         uint32_t next;
         if (!vol_->fatGet(curCluster_, &next)) return false;
         if (vol_->isEOC(next)) {
@@ -1190,31 +1383,41 @@ size_t SdFile::write(const void* buf, uint16_t nbyte) {
     if (n == 512) {
       // full block - don't need to use cache
       // invalidate cache if block is in cache
-      if (SdVolume::cacheBlockNumber_ == block) {
-        SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
+      SdVolume::cacheInvalidate(block);
+      // write the previous block first so blocks reach the card in order
+      if (!SdVolume::cacheFlushBlock(block - 1)) goto writeErrorReturn;
+      // appending - stream blocks with a multiple block write.  Only
+      // pre-erase the rest of this cluster, since it belongs to this file
+      if (curPosition_ >= fileSize_ && !vol_->isWriting(block)) {
+        uint32_t eraseCount = vol_->blocksPerCluster_ - blockOfCluster;
+        if (!vol_->writeStart(block, eraseCount)) goto writeErrorReturn;
       }
       if (!vol_->writeBlock(block, src)) goto writeErrorReturn;
       src += 512;
     } else {
       if (blockOffset == 0 && curPosition_ >= fileSize_) {
         // start of new block don't need to read into cache
-        if (!SdVolume::cacheFlush()) goto writeErrorReturn;
-        SdVolume::cacheBlockNumber_ = block;
-        SdVolume::cacheSetDirty();
+        if (!SdVolume::cacheFlushBlock(block - 1)) goto writeErrorReturn;
+        if (!SdVolume::cacheNewBlock(block, SdVolume::CACHE_POOL_DATA)) {
+          goto writeErrorReturn;
+        }
       } else {
         // rewrite part of block
         if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) {
           goto writeErrorReturn;
         }
       }
-      uint8_t* dst = SdVolume::cacheBuffer_.data + blockOffset;
+      uint8_t* dst = SdVolume::cacheBuffer_->data + blockOffset;
       uint8_t* end = dst + n;
       while (dst != end) *dst++ = *src++;
     }
     nToWrite -= n;
     curPosition_ += n;
   }
-  if (curPosition_ > fileSize_) {
+  if (flags_ & F_FILE_PREALLOCATED) {
+    // directory entry is updated by close()
+    if (curPosition_ > fileSize_) fileSize_ = curPosition_;
+  } else if (curPosition_ > fileSize_) {
     // update fileSize and insure sync will update dir entry
     fileSize_ = curPosition_;
     flags_ |= F_FILE_DIR_DIRTY;
@@ -21,11 +21,14 @@
 
 // SD card commands
 #define CMD0_GO_IDLE_STATE              0X00 // Init card in spi mode if CS low
+#define CMD6_SWITCH_FUNCTION            0X06 // Check or switch a card function, such as high speed mode
 #define CMD8_SEND_IF_COND               0X08 // Verify SD Memory Card interface operating condition
 #define CMD9_SEND_CSD                   0X09 // Read the Card Specific Data (CSD register)
 #define CMD10_SEND_CID                  0X0A // Read the card identification information (CID register)
+#define CMD12_STOP_TRANSMISSION         0X0C // Stop a multiple block read sequence
 #define CMD13_SEND_STATUS               0X0D // Read the card status register
 #define CMD17_READ_BLOCK                0X11 // Read a single data block from the card
+#define CMD18_READ_MULTIPLE_BLOCK       0X12 // Read blocks of data until a STOP_TRANSMISSION
 #define CMD24_WRITE_BLOCK               0X18 // Write a single data block to the card
 #define CMD25_WRITE_MULTIPLE_BLOCK      0X19 // Write blocks of data until a STOP_TRANSMISSION
 #define CMD32_ERASE_WR_BLK_START        0x20 // Sets the address of the first block to be erased
@@ -33,8 +36,10 @@
 #define CMD38_ERASE                     0X26 // Erase all previously selected blocks
 #define CMD55_APP_CMD                   0X37 // Escape for application specific command
 #define CMD58_READ_OCR                  0X3A // Read the OCR register of a card
+#define ACMD13_SD_STATUS                0X0D // Read the 64 byte SD status, which includes the speed class
 #define ACMD23_SET_WR_BLK_ERASE_COUNT   0X17 // Set the number of write blocks to be pre-erased before writing
 #define ACMD41_SD_SEND_OP_COMD          0X29 // Sends host capacity support information and activates the card's initialization process
+#define ACMD51_SEND_SCR                 0X33 // Read the SD configuration register (SCR)
 
 //------------------------------------------------------------------------------
 /** status for card in the ready state */
@@ -20,18 +20,29 @@
 #include "SdFat.h"
 //------------------------------------------------------------------------------
 // raw block cache
-// init cacheBlockNumber_to invalid SD block number
-uint32_t SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-cache_t  SdVolume::cacheBuffer_;     // 512 byte cache for Sd2Card
+// slots are marked empty by init() before the first block is cached
+cacheSlot_t SdVolume::cacheSlot_[CACHE_SLOTS];  // 512 byte caches for Sd2Card
+uint8_t  SdVolume::cacheCurrent_ = 0;   // slot of most recently used block
+cache_t* SdVolume::cacheBuffer_ = &SdVolume::cacheSlot_[0].buffer;
+uint32_t SdVolume::cacheUseCount_ = 0;  // LRU clock
+uint32_t SdVolume::cacheHits_ = 0;      // lookups found in the cache
+uint32_t SdVolume::cacheMisses_ = 0;    // lookups that read the card
 Sd2Card* SdVolume::sdCard_;          // pointer to SD card object
-uint8_t  SdVolume::cacheDirty_ = 0;  // cacheFlush() will write block if true
-uint32_t SdVolume::cacheMirrorBlock_ = 0;  // mirror  block for second FAT
 //------------------------------------------------------------------------------
 // find a contiguous group of clusters
 uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   // start of group
   uint32_t bgnCluster;
 
+  // fail fast if the count says there isn't room.  FSInfo's count is only
+  // advisory and another host may have left it stale, so count the free
+  // clusters in the FAT before believing it
+  if (freeClusterCount_ <= clusterCount_ && count > freeClusterCount_) {
+    if (freeCountIsHint_) freeClusterCount_ = FSINFO_UNKNOWN;
+    int32_t free = freeClusterCount();
+    if (free < 0 || count > (uint32_t)free) return false;
+  }
+
   // flag to save place to start next search
   uint8_t setStart;
 
@@ -90,49 +101,152 @@ uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   // return first cluster number to caller
   *curCluster = bgnCluster;
 
-  // remember possible next free cluster
-  if (setStart) allocSearchStart_ = bgnCluster + 1;
+  // remember possible next free cluster.  Clusters before the group may
+  // still be free unless the group started at the search start
+  if (setStart || bgnCluster == allocSearchStart_) {
+    allocSearchStart_ = bgnCluster + count;
+  }
+  // keep the free count current
+  if (freeClusterCount_ <= clusterCount_) freeClusterCount_ -= count;
+  fsInfoDirty_ = true;
 
   return true;
 }
 //------------------------------------------------------------------------------
+// return the slot holding blockNumber or -1 if it is not cached
+int8_t SdVolume::cacheFind(uint32_t blockNumber) {
+  for (uint8_t i = 0; i < CACHE_SLOTS; i++) {
+    if (cacheSlot_[i].blockNumber == blockNumber) return i;
+  }
+  return -1;
+}
+//------------------------------------------------------------------------------
+// write all dirty slots, lowest block first so data blocks appended
+// to a file reach the card in order
 uint8_t SdVolume::cacheFlush(void) {
-  if (cacheDirty_) {
-    if (!sdCard_->writeBlock(cacheBlockNumber_, cacheBuffer_.data)) {
+  while (1) {
+    int8_t slot = -1;
+    for (uint8_t i = 0; i < CACHE_SLOTS; i++) {
+      if (cacheSlot_[i].dirty && (slot < 0 ||
+        cacheSlot_[i].blockNumber < cacheSlot_[slot].blockNumber)) {
+        slot = i;
+      }
+    }
+    if (slot < 0) return true;
+    if (!cacheFlushSlot(slot)) return false;
+  }
+}
+//------------------------------------------------------------------------------
+// write blockNumber to the card if it is cached and dirty
+uint8_t SdVolume::cacheFlushBlock(uint32_t blockNumber) {
+  int8_t slot = cacheFind(blockNumber);
+  return slot < 0 ? true : cacheFlushSlot(slot);
+}
+//------------------------------------------------------------------------------
+uint8_t SdVolume::cacheFlushSlot(uint8_t slot) {
+  cacheSlot_t* s = &cacheSlot_[slot];
+  if (s->dirty) {
+    if (!sdCard_->writeBlock(s->blockNumber, s->buffer.data)) {
       return false;
     }
     // mirror FAT tables
-    if (cacheMirrorBlock_) {
-      if (!sdCard_->writeBlock(cacheMirrorBlock_, cacheBuffer_.data)) {
+    if (s->mirrorBlock) {
+      if (!sdCard_->writeBlock(s->mirrorBlock, s->buffer.data)) {
         return false;
       }
-      cacheMirrorBlock_ = 0;
+      s->mirrorBlock = 0;
     }
-    cacheDirty_ = 0;
+    s->dirty = 0;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// drop blockNumber from the cache without writing it
+void SdVolume::cacheInvalidate(uint32_t blockNumber) {
+  int8_t slot = cacheFind(blockNumber);
+  if (slot < 0) return;
+  cacheSlot_[slot].blockNumber = 0XFFFFFFFF;
+  cacheSlot_[slot].mirrorBlock = 0;
+  cacheSlot_[slot].dirty = 0;
+}
+//------------------------------------------------------------------------------
+// empty every slot without writing - used when a card is initialized
+void SdVolume::cacheInvalidateAll(void) {
+  for (uint8_t i = 0; i < CACHE_SLOTS; i++) {
+    cacheSlot_[i].blockNumber = 0XFFFFFFFF;
+    cacheSlot_[i].mirrorBlock = 0;
+    cacheSlot_[i].lastUsed = 0;
+    cacheSlot_[i].dirty = 0;
   }
+}
+//------------------------------------------------------------------------------
+// assign a dirty slot to blockNumber without reading the card.  The
+// caller must fill the buffer.
+uint8_t SdVolume::cacheNewBlock(uint32_t blockNumber, uint8_t pool) {
+  int8_t slot = cacheFind(blockNumber);
+  if (slot < 0) {
+    slot = cacheVictim(pool);
+    if (slot < 0) return false;
+    cacheSlot_[slot].blockNumber = blockNumber;
+  }
+  cacheUse(slot);
+  cacheSetDirty();
   return true;
 }
 //------------------------------------------------------------------------------
-uint8_t SdVolume::cacheRawBlock(uint32_t blockNumber, uint8_t action) {
-  if (cacheBlockNumber_ != blockNumber) {
-    if (!cacheFlush()) return false;
-    if (!sdCard_->readBlock(blockNumber, cacheBuffer_.data)) return false;
-    cacheBlockNumber_ = blockNumber;
+uint8_t SdVolume::cacheRawBlock(uint32_t blockNumber,
+                                uint8_t action, uint8_t pool) {
+  int8_t slot = cacheFind(blockNumber);
+  if (slot < 0) {
+    cacheMisses_++;
+    slot = cacheVictim(pool);
+    if (slot < 0) return false;
+    if (!sdCard_->readBlock(blockNumber, cacheSlot_[slot].buffer.data)) {
+      return false;
+    }
+    cacheSlot_[slot].blockNumber = blockNumber;
+  } else {
+    cacheHits_++;
   }
-  cacheDirty_ |= action;
+  cacheUse(slot);
+  cacheSlot_[slot].dirty |= action;
   return true;
 }
 //------------------------------------------------------------------------------
+// make slot the current block for cacheBuffer_ and update its LRU time
+void SdVolume::cacheUse(uint8_t slot) {
+  cacheSlot_[slot].lastUsed = ++cacheUseCount_;
+  cacheCurrent_ = slot;
+  cacheBuffer_ = &cacheSlot_[slot].buffer;
+}
+//------------------------------------------------------------------------------
+// free the least recently used slot in pool, writing it if dirty.
+// FAT and directory blocks have their own slots so file data can't
+// push them out.  return the empty slot or -1 for failure
+int8_t SdVolume::cacheVictim(uint8_t pool) {
+  uint8_t first = pool == CACHE_POOL_META ? 0 : CACHE_META_SLOTS;
+  uint8_t last = pool == CACHE_POOL_META ? CACHE_META_SLOTS : CACHE_SLOTS;
+  uint8_t slot = first;
+  for (uint8_t i = first; i < last; i++) {
+    if (cacheSlot_[i].blockNumber == 0XFFFFFFFF) {
+      slot = i;
+      break;
+    }
+    if (cacheSlot_[i].lastUsed < cacheSlot_[slot].lastUsed) slot = i;
+  }
+  if (!cacheFlushSlot(slot)) return -1;
+  cacheSlot_[slot].blockNumber = 0XFFFFFFFF;
+  return slot;
+}
+//------------------------------------------------------------------------------
 // cache a zero block for blockNumber
 uint8_t SdVolume::cacheZeroBlock(uint32_t blockNumber) {
-  if (!cacheFlush()) return false;
+  if (!cacheNewBlock(blockNumber, CACHE_POOL_META)) return false;
 
-  // loop take less flash than memset(cacheBuffer_.data, 0, 512);
+  // loop take less flash than memset(cacheBuffer_->data, 0, 512);
   for (uint16_t i = 0; i < 512; i++) {
-    cacheBuffer_.data[i] = 0;
+    cacheBuffer_->data[i] = 0;
   }
-  cacheBlockNumber_ = blockNumber;
-  cacheSetDirty();
   return true;
 }
 //------------------------------------------------------------------------------
@@ -152,13 +266,11 @@ uint8_t SdVolume::fatGet(uint32_t cluster, uint32_t* value) const {
   if (cluster > (clusterCount_ + 1)) return false;
   uint32_t lba = fatStartBlock_;
   lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
-  if (lba != cacheBlockNumber_) {
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
-  }
+  if (!cacheRawBlock(lba, CACHE_FOR_READ, CACHE_POOL_META)) return false;
   if (fatType_ == 16) {
-    *value = cacheBuffer_.fat16[cluster & 0XFF];
+    *value = cacheBuffer_->fat16[cluster & 0XFF];
   } else {
-    *value = cacheBuffer_.fat32[cluster & 0X7F] & FAT32MASK;
+    *value = cacheBuffer_->fat32[cluster & 0X7F] & FAT32MASK;
   }
   return true;
 }
@@ -175,27 +287,24 @@ uint8_t SdVolume::fatPut(uint32_t cluster, uint32_t value) {
   uint32_t lba = fatStartBlock_;
   lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
 
-  if (lba != cacheBlockNumber_) {
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
-  }
+  if (!cacheRawBlock(lba, CACHE_FOR_READ, CACHE_POOL_META)) return false;
   // store entry
   if (fatType_ == 16) {
-    cacheBuffer_.fat16[cluster & 0XFF] = value;
+    cacheBuffer_->fat16[cluster & 0XFF] = value;
   } else {
-    cacheBuffer_.fat32[cluster & 0X7F] = value;
+    cacheBuffer_->fat32[cluster & 0X7F] = value;
   }
   cacheSetDirty();
 
   // mirror second FAT
-  if (fatCount_ > 1) cacheMirrorBlock_ = lba + blocksPerFat_;
+  if (fatCount_ > 1) {
+    cacheSlot_[cacheCurrent_].mirrorBlock = lba + blocksPerFat_;
+  }
   return true;
 }
 //------------------------------------------------------------------------------
 // free a cluster chain
 uint8_t SdVolume::freeChain(uint32_t cluster) {
-  // clear free cluster location
-  allocSearchStart_ = 2;
-
   do {
     uint32_t next;
     if (!fatGet(cluster, &next)) return false;
@@ -203,12 +312,76 @@ uint8_t SdVolume::freeChain(uint32_t cluster) {
     // free cluster
     if (!fatPut(cluster, 0)) return false;
 
+    // search for free clusters from the lowest one freed
+    if (cluster < allocSearchStart_) allocSearchStart_ = cluster;
+
+    // keep the free count current
+    if (freeClusterCount_ < clusterCount_) freeClusterCount_++;
+    fsInfoDirty_ = true;
+
     cluster = next;
   } while (!isEOC(cluster));
 
   return true;
 }
 //------------------------------------------------------------------------------
+/**
+ * Return the number of free clusters in the volume.
+ *
+ * The count is taken from the FAT32 FSInfo sector when the volume is
+ * initialized, and kept current as clusters are allocated and freed.  The
+ * FAT is only scanned if the count is not known, for FAT16 volumes or if
+ * FSInfo is invalid, and the result is remembered.  It is also scanned if
+ * FSInfo's count is too small for an allocation, because FSInfo is only
+ * advisory.
+ *
+ * \return The number of free clusters or -1 if an error occurs.
+ */
+int32_t SdVolume::freeClusterCount(void) {
+  if (freeClusterCount_ > clusterCount_) {
+    if (fatType_ != 16 && fatType_ != 32) return -1;
+    uint32_t free = 0;
+    uint32_t lba = fatStartBlock_;
+    uint16_t n = fatType_ == 16 ? 256 : 128;
+
+    // entries zero and one are reserved and never zero
+    for (uint32_t todo = clusterCount_ + 2; todo; todo -= n) {
+      if (todo < n) n = todo;
+      if (!cacheRawBlock(lba++, CACHE_FOR_READ, CACHE_POOL_META)) return -1;
+      for (uint16_t i = 0; i < n; i++) {
+        if (fatType_ == 16) {
+          if (cacheBuffer_->fat16[i] == 0) free++;
+        } else {
+          if ((cacheBuffer_->fat32[i] & FAT32MASK) == 0) free++;
+        }
+      }
+    }
+    freeClusterCount_ = free;
+    freeCountIsHint_ = false;
+    fsInfoDirty_ = true;
+  }
+  return freeClusterCount_;
+}
+//------------------------------------------------------------------------------
+/**
+ * Write the free cluster count and next free cluster hint to the FAT32
+ * FSInfo sector if they have changed.  Called by SdFile::sync().
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdVolume::fsInfoSync(void) {
+  if (!fsInfoDirty_ || !fsInfoBlock_) return true;
+  if (!cacheRawBlock(fsInfoBlock_, CACHE_FOR_WRITE, CACHE_POOL_META)) {
+    return false;
+  }
+  cacheBuffer_->fsinfo.freeCount = freeClusterCount_ <= clusterCount_ ?
+                                   freeClusterCount_ : FSINFO_UNKNOWN;
+  cacheBuffer_->fsinfo.nextFree = allocSearchStart_;
+  fsInfoDirty_ = false;
+  return true;
+}
+//------------------------------------------------------------------------------
 /**
  * Initialize a FAT volume.
  *
@@ -227,12 +400,22 @@ uint8_t SdVolume::freeChain(uint32_t cluster) {
 uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
   uint32_t volumeStartBlock = 0;
   sdCard_ = dev;
+  // allocation hints from a previous card are no longer valid
+  allocSearchStart_ = 2;
+  freeClusterCount_ = FSINFO_UNKNOWN;
+  freeCountIsHint_ = false;
+  fsInfoBlock_ = 0;
+  fsInfoDirty_ = false;
+  // blocks cached from a previous card are no longer valid
+  cacheInvalidateAll();
   // if part == 0 assume super floppy with FAT boot sector in block zero
   // if part > 0 assume mbr volume with partition table
   if (part) {
     if (part > 4)return false;
-    if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) return false;
-    part_t* p = &cacheBuffer_.mbr.part[part-1];
+    if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ, CACHE_POOL_META)) {
+      return false;
+    }
+    part_t* p = &cacheBuffer_->mbr.part[part-1];
     if ((p->boot & 0X7F) !=0  ||
       p->totalSectors < 100 ||
       p->firstSector == 0) {
@@ -241,14 +424,16 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
     }
     volumeStartBlock = p->firstSector;
   }
-  if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) return false;
-  bpb_t* bpb = &cacheBuffer_.fbs.bpb;
+  if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ, CACHE_POOL_META)) {
+    return false;
+  }
+  bpb_t* bpb = &cacheBuffer_->fbs.bpb;
   if (bpb->bytesPerSector != 512 ||
     bpb->fatCount == 0 ||
     bpb->reservedSectorCount == 0 ||
     bpb->sectorsPerCluster == 0) {
        // not valid FAT volume
-      cacheBlockNumber_ = -1;
+      cacheInvalidate(volumeStartBlock);
       return false;
   }
   fatCount_ = bpb->fatCount;
@@ -291,6 +476,32 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
   } else {
     rootDirStart_ = bpb->fat32RootCluster;
     fatType_ = 32;
+    if (bpb->fat32FSInfo) {
+      fsInfoBlock_ = volumeStartBlock + bpb->fat32FSInfo;
+      if (!fsInfoInit()) fsInfoBlock_ = 0;
+    }
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// read the free cluster count and next free cluster from FSInfo.  The
+// hints are only used if they are in range
+uint8_t SdVolume::fsInfoInit(void) {
+  if (!cacheRawBlock(fsInfoBlock_, CACHE_FOR_READ, CACHE_POOL_META)) {
+    return false;
+  }
+  fsinfo_t* fsi = &cacheBuffer_->fsinfo;
+  if (fsi->leadSignature != FSINFO_LEAD_SIG ||
+    fsi->structSignature != FSINFO_STRUCT_SIG ||
+    fsi->tailSignature != FSINFO_TAIL_SIG) {
+    return false;
+  }
+  if (fsi->freeCount <= clusterCount_) {
+    freeClusterCount_ = fsi->freeCount;
+    freeCountIsHint_ = true;
+  }
+  if (fsi->nextFree >= 2 && fsi->nextFree <= clusterCount_ + 1) {
+    allocSearchStart_ = fsi->nextFree;
   }
   return true;
 }
@@ -9,9 +9,8 @@ void bake() {
   uint8_t counter = 0;
   uint8_t bakePhase = BAKING_PHASE_HEATUP;
   double currentTemperature = getCurrentTemperature();
-  uint8_t elementDutyCounter[NUMBER_OF_OUTPUTS];
   boolean isOneSecondInterval = false;
-  uint16_t iconsX, i;
+  uint16_t iconsX;
   uint8_t bakeDutyCycle, bakeIntegral = 0, coolingDuration = 0;
   boolean isHeating = true;
   long lastOverTempTime = 0;
@@ -27,6 +26,10 @@ void bake() {
   secondsLeftOfBake = getBakeSeconds(prefs.bakeDuration);
   // Start with a duty cycle proportional to the desired temperature
   bakeDutyCycle = map(prefs.bakeTemperature, 0, 250, 0, 100);
+  // Count thermocouple faults for this bake only
+  clearThermocoupleStatus();
+  // Heating up is gentle, so let the measured noise pick the thermocouple averaging
+  setTemperatureMode(TEMPERATURE_MODE_AUTO);
 
   // Calculate the centered position of the heating and fan icons (icons are 32x32)
   iconsX = 240 - (numOutputsConfigured() * 20) + 4;  // (2*20) - 32 = 8.  8/2 = 4
@@ -34,10 +37,8 @@ void bake() {
   // Turn on any convection fans
   setOvenOutputs(ELEMENTS_OFF, CONVECTION_FAN_ON, COOLING_FAN_OFF);
 
-  // Stagger the element start cycle to avoid abrupt changes in current draw
-  // Simple method: there are 6 outputs but the first ones are likely the heating elements
-  for (i=0; i< NUMBER_OF_OUTPUTS; i++)
-    elementDutyCounter[i] = (70 * i) % 100;
+  // The elements are switched by the timer interrupt while baking
+  startElementScheduler();
 
   // Set up the screen in preparation for baking
   // Erase the bottom part of the screen
@@ -165,6 +166,8 @@ userChangedMindAboutAborting:
         if (prefs.bakeTemperature - currentTemperature < 15.0) {
           bakePhase = BAKING_PHASE_BAKE;
           displayBakePhase(bakePhase, abortDialogIsOnScreen);
+          // Baking is long and slow, so favor less noise over a quick response
+          setTemperatureMode(TEMPERATURE_MODE_QUIET);
           // Reduce the duty cycle for the last 15 degrees
           bakeDutyCycle = bakeDutyCycle / 3;
           SerialUSB.println("Move to bake phase");
@@ -232,6 +235,7 @@ userChangedMindAboutAborting:
         // Turn off all elements and turn on the fans
         setOvenOutputs(ELEMENTS_OFF, CONVECTION_FAN_ON, COOLING_FAN_ON);
      
+        setTemperatureMode(TEMPERATURE_MODE_AUTO);
         // Move to the next phase
         bakePhase = BAKING_PHASE_COOLING;
         displayBakePhase(bakePhase, abortDialogIsOnScreen);
@@ -277,49 +281,22 @@ userChangedMindAboutAborting:
 
       case BAKING_PHASE_ABORT:
         SerialUSB.println("Bake is over!");
+        printThermocoupleStatus(&SerialUSB);
+        setTemperatureMode(TEMPERATURE_MODE_NORMAL);
         // Turn all elements and fans off
         setOvenOutputs(ELEMENTS_OFF, CONVECTION_FAN_OFF, COOLING_FAN_OFF);
+        stopElementScheduler();
         // Close the oven door now, over 3 seconds
         setServoPosition(prefs.servoClosedDegrees, 3000);
         // Return to the main menu
         return;
     }
  
-    // Turn the outputs on or off based on the duty cycle
-    if (isHeating) {
-      for (i=0; i< NUMBER_OF_OUTPUTS; i++) {
-        switch (prefs.outputType[i]) {
-          case TYPE_TOP_ELEMENT:
-            // Turn the output on at 0, and off at the duty cycle value
-            if (elementDutyCounter[i] == 0)
-              setOutput(i, HIGH);
-            // Restrict the top element's duty cycle to 75% to protect the insulation
-            // and reduce IR heating of components
-            if (elementDutyCounter[i] == (bakeDutyCycle < 75? bakeDutyCycle: 75))
-              setOutput(i, LOW);
-            break;
-          case TYPE_BOTTOM_ELEMENT:
-            // Turn the output on at 0, and off at the duty cycle value
-            if (elementDutyCounter[i] == 0)
-              setOutput(i, HIGH);
-            if (elementDutyCounter[i] == bakeDutyCycle)
-              setOutput(i, LOW);
-            break;
-          
-          case TYPE_BOOST_ELEMENT: 
-            // Give it half the duty cycle of the other elements
-            // Turn the output on at 0, and off at the duty cycle value
-            if (elementDutyCounter[i] == 0)
-              setOutput(i, HIGH);
-            if (elementDutyCounter[i] == bakeDutyCycle/2)
-              setOutput(i, LOW);
-          break;
-        }
-      
-        // Increment the duty counter
-        elementDutyCounter[i] = (elementDutyCounter[i] + 1) % 100;
-      }
-    }
+    // Pass the duty cycles to the element scheduler.  The timer interrupt turns the outputs on and off.
+    // Restrict the top element's duty cycle to 75% to protect the insulation and reduce IR heating of
+    // components, and give the boost element half the duty cycle of the other elements
+    if (isHeating)
+      setElementDuties(bakeDutyCycle, bakeDutyCycle < 75? bakeDutyCycle: 75, bakeDutyCycle/2);
 
     animateIcons(iconsX);  
   } // end of big while loop
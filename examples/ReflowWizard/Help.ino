@@ -54,6 +54,20 @@ void showHelp(uint8_t screen)
       eraseHelpScreen(430, HELP_BOX_HEIGHT(6));
       break;
       
+    case SCREEN_ELEMENT_LIMIT:
+      drawHelpBorder(445, HELP_BOX_HEIGHT(7));
+      displayHelpLine((char *) "If your oven trips the breaker");
+      displayHelpLine((char *) "when all the elements are on,");
+      displayHelpLine((char *) "limit how many can be on at once.");
+      displayHelpLine((char *) "The elements take turns, so the");
+      displayHelpLine((char *) "oven heats more slowly but never");
+      displayHelpLine((char *) "draws more than that many");
+      displayHelpLine((char *) "elements' worth of current.");
+      getTap(SHOW_TEMPERATURE_IN_HEADER);
+      // Clear the area used by Help.  The screen will need to be redrawn
+      eraseHelpScreen(445, HELP_BOX_HEIGHT(7));
+      break;
+
     case SCREEN_SERVO_OPEN:
       drawHelpBorder(445, HELP_BOX_HEIGHT(7));
       displayHelpLine((char *) "You can use a servo to open");
@@ -121,6 +135,19 @@ void showHelp(uint8_t screen)
       eraseHelpScreen(445, HELP_BOX_HEIGHT(7));
       break;
 
+    case SCREEN_DIAGNOSTICS:
+      drawHelpBorder(445, HELP_BOX_HEIGHT(6));
+      displayHelpLine((char *) "Every thermocouple fault is counted,");
+      displayHelpLine((char *) "even ones that are ignored because");
+      displayHelpLine((char *) "they don't last long.  The time is");
+      displayHelpLine((char *) "seconds since the fault last"); 
+      displayHelpLine((char *) "happened.  Counts are reset at the"); 
+      displayHelpLine((char *) "start of each reflow or bake."); 
+      getTap(SHOW_TEMPERATURE_IN_HEADER);
+      // Clear the area used by Help.  The screen will need to be redrawn
+      eraseHelpScreen(445, HELP_BOX_HEIGHT(6));
+      break;
+
     case SCREEN_BAKE:
     case SCREEN_EDIT_BAKE1:
       drawHelpBorder(460, HELP_BOX_HEIGHT(6));
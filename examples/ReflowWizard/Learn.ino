@@ -29,7 +29,6 @@ void learn() {
   uint8_t counter = 0;
   uint8_t learningPhase = LEARNING_PHASE_INITIAL_RAMP;
   double currentTemperature = 0;
-  uint8_t elementDutyCounter[NUMBER_OF_OUTPUTS];
   boolean isOneSecondInterval = false;
   uint16_t iconsX, i;
   uint8_t learningDutyCycle, learningIntegral = 0, coolingDuration = 0;
@@ -47,6 +46,9 @@ void learn() {
   secondsLeftOfLearning = LEARNING_RAMP_TO_TEMP_DURATION + LEARNING_CONSTANT_TEMP_DURATION + LEARNING_INERTIA_DURATION + LEARNING_COOLING_DURATION;
   secondsLeftOfPhase = LEARNING_RAMP_TO_TEMP_DURATION + LEARNING_CONSTANT_TEMP_DURATION;
   
+  // Use the default thermocouple settings, so learned values are consistent
+  setTemperatureMode(TEMPERATURE_MODE_NORMAL);
+
   // Start with a duty cycle appropriate to the testing temperature
   learningDutyCycle = 60;
 
@@ -56,10 +58,8 @@ void learn() {
   // Turn on any convection fans
   setOvenOutputs(ELEMENTS_OFF, CONVECTION_FAN_ON, COOLING_FAN_OFF);
 
-  // Stagger the element start cycle to avoid abrupt changes in current draw
-  // Simple method: there are 6 outputs but the first ones are likely the heating elements
-  for (i=0; i< NUMBER_OF_OUTPUTS; i++)
-    elementDutyCounter[i] = (65 * i) % 100;
+  // The elements are switched by the timer interrupt while learning
+  startElementScheduler();
 
   // Set up the screen in preparation for learning
   // Erase the bottom part of the screen
@@ -444,6 +444,7 @@ userChangedMindAboutAborting:
         SerialUSB.println("Learning is over!");
         // Turn all elements and fans off
         setOvenOutputs(ELEMENTS_OFF, CONVECTION_FAN_OFF, COOLING_FAN_OFF);
+        stopElementScheduler();
         // Close the oven door now, over 3 seconds
         setServoPosition(prefs.servoClosedDegrees, 3000);
         // Undo any learned values that weren't saved (prefs are saved if learning completes successfully)
@@ -452,41 +453,11 @@ userChangedMindAboutAborting:
         return;
     }
  
-    // Turn the outputs on or off based on the duty cycle
-    if (isHeating) {
-      for (i=0; i< NUMBER_OF_OUTPUTS; i++) {
-        switch (prefs.outputType[i]) {
-          case TYPE_TOP_ELEMENT:
-            // Turn the output on at 0, and off at the duty cycle value
-            if (elementDutyCounter[i] == 0)
-              setOutput(i, HIGH);
-            // Restrict the top element's duty cycle to 80% to protect the insulation
-            // and reduce IR heating of components
-            if (elementDutyCounter[i] == (learningDutyCycle < 80? learningDutyCycle: 80))
-              setOutput(i, LOW);
-            break;
-          case TYPE_BOTTOM_ELEMENT:
-            // Turn the output on at 0, and off at the duty cycle value
-            if (elementDutyCounter[i] == 0)
-              setOutput(i, HIGH);
-            if (elementDutyCounter[i] == learningDutyCycle)
-              setOutput(i, LOW);
-            break;
-          
-          case TYPE_BOOST_ELEMENT: 
-            // Give it half the duty cycle of the other elements
-            // Turn the output on at 0, and off at the duty cycle value
-            if (elementDutyCounter[i] == 0)
-              setOutput(i, HIGH);
-            if (elementDutyCounter[i] == learningDutyCycle/2)
-              setOutput(i, LOW);
-          break;
-        }
-      
-        // Increment the duty counter
-        elementDutyCounter[i] = (elementDutyCounter[i] + 1) % 100;
-      }
-    }
+    // Pass the duty cycles to the element scheduler.  The timer interrupt turns the outputs on and off.
+    // Restrict the top element's duty cycle to 80% to protect the insulation and reduce IR heating of
+    // components, and give the boost element half the duty cycle of the other elements
+    if (isHeating)
+      setElementDuties(learningDutyCycle, learningDutyCycle < 80? learningDutyCycle: 80, learningDutyCycle/2);
 
     animateIcons(iconsX);  
   } // end of big while loop
@@ -0,0 +1,272 @@
+// Written by Peter Easton
+// Released under the MIT license
+// Build a reflow oven: https://whizoo.com
+
+
+// Logging to the SD card
+// ======================
+// The control loop must not wait for the SD card.  Writes normally take a millisecond or two, but a card
+// can stall for 100ms or more while it does its own housekeeping.  So the control loop only copies a
+// small binary record into a ring buffer in RAM.  drainLogBuffer() is called when the control loop has
+// nothing else to do.  It copies the records into a 512-byte block buffer, and only writes to the card
+// when the block is full.  Whole, block-aligned writes go straight to the card without reading anything
+// first.
+//
+// If the card stalls for long enough that the ring buffer fills up, new samples are dropped and counted.
+// closeLogBuffer() writes everything still in RAM before closing the file, whether the reflow finished
+// or was aborted.
+//
+// The log is binary (see logFileHeader in ReflowWizard.h) so nothing is formatted while the oven is
+// running, and the index lets a reader jump straight to any part of the run.  A CSV file with the same
+// columns as earlier versions is generated from the binary log once it has been closed.
+
+#define LOG_RING_SAMPLES      16      // Samples buffered in RAM (16 seconds of logging)
+#define LOG_BLOCK_SIZE        512     // Data is written to the SD card a block at a time
+
+File logFile;
+boolean logFileOpen = false;
+char logFileName[13];
+logFileHeader logHeader;
+logRecord logRing[LOG_RING_SAMPLES];
+uint8_t logRingHead, logRingTail;                // Samples are added at the head and taken from the tail
+char logBlock[LOG_BLOCK_SIZE];
+uint16_t logBlockLength;
+logIndexEntry logIndex[LOG_INDEX_ENTRIES];
+uint32_t nextIndexSeconds;
+
+
+// Start logging to logFile, which has just been opened.  The header records the profile and settings used
+void startLogBuffer(char *fileName, uint8_t profileNo)
+{
+  strncpy(logFileName, fileName, 12);
+  logFileName[12] = 0;
+  logFileOpen = true;
+  logRingHead = 0;
+  logRingTail = 0;
+  nextIndexSeconds = 0;
+
+  memset(&logHeader, 0, sizeof(logHeader));
+  logHeader.magic = LOG_FILE_MAGIC;
+  logHeader.version = LOG_FILE_VERSION;
+  logHeader.recordSize = sizeof(logRecord);
+  logHeader.indexInterval = LOG_INDEX_INTERVAL;
+  strcpy(logHeader.profileName, prefs.profile[profileNo].name);
+  logHeader.numThermocouples = NUM_THERMOCOUPLES;
+  for (uint8_t i=0; i< NUM_THERMOCOUPLES; i++) {
+    if (isThermocoupleEnabled(i))
+      logHeader.thermocouplesEnabled |= 1 << i;
+  }
+  memcpy(logHeader.outputType, prefs.outputType, NUMBER_OF_OUTPUTS);
+  logHeader.lineVoltageFrequency = prefs.lineVoltageFrequency;
+  logHeader.servoOpenDegrees = prefs.servoOpenDegrees;
+  logHeader.servoClosedDegrees = prefs.servoClosedDegrees;
+  logHeader.learnedPower = prefs.learnedPower;
+  logHeader.learnedInertia = prefs.learnedInertia;
+  logHeader.learnedInsulation = prefs.learnedInsulation;
+
+  // The header fills the first block.  It is written again when the log is closed
+  writeLogHeader();
+}
+
+
+// Write the header as the whole of the first block
+void writeLogHeader()
+{
+  memset(logBlock, 0, LOG_BLOCK_SIZE);
+  memcpy(logBlock, &logHeader, sizeof(logHeader));
+  logBlockLength = LOG_HEADER_SIZE;
+  writeLogBlock();
+}
+
+
+// Add data to the block buffer, writing the block to the SD card each time it fills up
+void logWrite(const uint8_t *data, uint16_t length)
+{
+  while (length) {
+    uint16_t n = min(length, LOG_BLOCK_SIZE - logBlockLength);
+    memcpy(logBlock + logBlockLength, data, n);
+    logBlockLength += n;
+    data += n;
+    length -= n;
+    if (logBlockLength == LOG_BLOCK_SIZE)
+      writeLogBlock();
+  }
+}
+
+
+// Write whatever is in the block buffer to the SD card
+void writeLogBlock()
+{
+  if (!logBlockLength)
+    return;
+  logFile.write((uint8_t *) logBlock, logBlockLength);
+  // Make sure the data is on the card.  The log file is preallocated so this only writes the data block
+  logFile.flush();
+  logBlockLength = 0;
+}
+
+
+// Take a sample of the temperatures.  This is called from the control loop so it must not touch the SD card
+void logSampleToBuffer(uint32_t seconds, uint8_t phase, uint8_t token)
+{
+  MAX31856Status status;
+  uint8_t next = (logRingHead + 1) % LOG_RING_SAMPLES;
+
+  if (!logFileOpen)
+    return;
+  // Is the ring buffer full?  Drop this sample rather than wait for the SD card
+  if (next == logRingTail) {
+    logHeader.samplesDropped++;
+    return;
+  }
+
+  logRecord *record = &logRing[logRingHead];
+  thermocouple.getStatus(&status);
+  record->seconds = seconds;
+  for (uint8_t i=0; i< NUM_THERMOCOUPLES; i++) {
+    float t = isThermocoupleEnabled(i)? getChannelTemperature(i) : FAULT_OPEN;
+    // Round to the nearest tenth of a degree
+    record->temperature[i] = IS_MAX31856_ERROR(t)? LOG_NO_TEMPERATURE : (int16_t) (t * 10 + (t < 0? -0.5 : 0.5));
+  }
+  record->coldJunction = (int16_t) (status.coldJunction * 100 + (status.coldJunction < 0? -0.5 : 0.5));
+  record->faultStatus = status.status;
+  record->phase = phase;
+  record->token = token;
+  memset(record->reserved, 0, sizeof(record->reserved));
+  logRingHead = next;
+}
+
+
+// Remember where the record for this second is in the file.  When the index is full every other entry
+// is discarded and entries are added half as often, so the index always covers the whole run
+void addToLogIndex(uint32_t seconds, uint32_t offset)
+{
+  if (seconds < nextIndexSeconds)
+    return;
+  if (logHeader.indexEntries == LOG_INDEX_ENTRIES) {
+    for (uint8_t i=0; i< LOG_INDEX_ENTRIES / 2; i++)
+      logIndex[i] = logIndex[i * 2];
+    logHeader.indexEntries = LOG_INDEX_ENTRIES / 2;
+    logHeader.indexInterval *= 2;
+  }
+  logIndex[logHeader.indexEntries].seconds = seconds;
+  logIndex[logHeader.indexEntries].offset = offset;
+  logHeader.indexEntries++;
+  nextIndexSeconds = seconds + logHeader.indexInterval;
+}
+
+
+// Copy one buffered record into the block buffer.  Call this when the control loop has time to spare.
+// Returns true if there are more records waiting
+boolean drainLogBuffer()
+{
+  if (!logFileOpen || logRingTail == logRingHead)
+    return false;
+
+  logRecord *record = &logRing[logRingTail];
+  addToLogIndex(record->seconds, LOG_HEADER_SIZE + logHeader.numRecords * sizeof(logRecord));
+  logWrite((uint8_t *) record, sizeof(logRecord));
+  logHeader.numRecords++;
+  logRingTail = (logRingTail + 1) % LOG_RING_SAMPLES;
+  return logRingTail != logRingHead;
+}
+
+
+// Write everything that is still buffered, then the index and the final header, and close the log file.
+// The CSV version of the log is written after that
+void closeLogBuffer()
+{
+  if (!logFileOpen)
+    return;
+
+  while (drainLogBuffer())
+    ;
+  logHeader.indexOffset = LOG_HEADER_SIZE + logHeader.numRecords * sizeof(logRecord);
+  logWrite((uint8_t *) logIndex, logHeader.indexEntries * sizeof(logIndexEntry));
+  writeLogBlock();
+  if (logHeader.samplesDropped) {
+    sprintf(buffer100Bytes, "Samples dropped: %lu", logHeader.samplesDropped);
+    SerialUSB.println(buffer100Bytes);
+  }
+
+  // Rewrite the header now that it points to the index
+  logFile.seek(0);
+  writeLogHeader();
+  logFile.close();
+  logFileOpen = false;
+
+  // Write the CSV file, and add the thermocouple status for this run to the end of it
+  strcpy(buffer100Bytes, logFileName);
+  strcpy(strchr(buffer100Bytes, '.'), ".csv");
+  if (!convertLogToCSV(logFileName, buffer100Bytes))
+    return;
+  File csv = SD.open(buffer100Bytes, FILE_WRITE);
+  if (csv) {
+    printThermocoupleStatus(&csv);
+    csv.close();
+  }
+}
+
+
+// Convert a binary log to CSV, with the same columns as the logs written by earlier versions.  Temperatures
+// are logged to a tenth of a degree, so they are printed with one decimal place
+boolean convertLogToCSV(char *binName, char *csvName)
+{
+  logFileHeader header;
+  logRecord record;
+  char line[60];
+  uint32_t numRecords;
+  uint8_t i;
+
+  File bin = SD.open(binName);
+  if (!bin)
+    return false;
+  // A log that wasn't closed is still the size it was preallocated to, so the records can't be counted
+  if (bin.read(&header, sizeof(header)) != sizeof(header) || header.magic != LOG_FILE_MAGIC || header.recordSize != sizeof(logRecord) ||
+      !header.indexOffset) {
+    bin.close();
+    return false;
+  }
+  numRecords = header.numRecords;
+
+  // Opening for write appends, so replace any earlier CSV with this name
+  SD.remove(csvName);
+  File csv = SD.open(csvName, FILE_WRITE);
+  if (!csv) {
+    bin.close();
+    return false;
+  }
+  csv.println(header.profileName);
+  csv.print("Seconds");
+  for (i=0; i< NUM_THERMOCOUPLES; i++) {
+    if (header.thermocouplesEnabled & (1 << i)) {
+      csv.print(",");
+      csv.print(thermocoupleName[i]);
+    }
+  }
+  csv.println(",Cold Junction,Fault Status");
+
+  // Signs are printed separately so values between -1 and 0 aren't shown as positive
+  bin.seek(LOG_HEADER_SIZE);
+  while (numRecords-- && bin.read(&record, sizeof(record)) == sizeof(record)) {
+    sprintf(line, "%ld", record.seconds);
+    for (i=0; i< NUM_THERMOCOUPLES; i++) {
+      if (!(header.thermocouplesEnabled & (1 << i)))
+        continue;
+      if (record.temperature[i] == LOG_NO_TEMPERATURE)
+        strcat(line, ",");
+      else
+        sprintf(line + strlen(line), ",%s%d.%d", record.temperature[i] < 0? "-": "", abs(record.temperature[i]) / 10, abs(record.temperature[i]) % 10);
+    }
+    sprintf(line + strlen(line), ",%s%d.%02d,%02X", record.coldJunction < 0? "-": "", abs(record.coldJunction) / 100, abs(record.coldJunction) % 100, record.faultStatus);
+    csv.println(line);
+  }
+  if (header.samplesDropped) {
+    sprintf(line, "Samples dropped: %lu", header.samplesDropped);
+    csv.println(line);
+  }
+
+  bin.close();
+  csv.close();
+  return true;
+}
@@ -20,13 +20,57 @@
 //  - No input protection and no MOSFET
 //  - Can be used as a digital input, if necessary using pinMode(SCK, INPUT) and digitalRead(SCK)
 //  - Output 6 = PB11 (Arduino = SCK)
+//  - Or it can be the chip-select of a second MAX31856 (see Temperature)
+//  - Or it can be the input from a mains zero-cross detector (see below)
 //
 //  On the board (and in the build guide) the outputs are 1 through 6. In software they are 0 through 5.
+//
+// Heating element scheduler
+// =========================
+// Reflow, bake and learn only decide the duty cycle of each element.  The elements are switched by the
+// 20ms timer interrupt (see Servo.ino), so a slow screen update, SD card write or tune in the control
+// loop doesn't stretch the duty cycle window and change the power delivered.  The window is 100
+// interrupts, or 2 seconds.  At the start of each window the on-times of the elements are laid end to
+// end around it, so a second element only turns on when the first one turns off.  Two elements at 50%
+// never overlap, and at most ceil(total duty / 100) elements are on at the same time.  The time between
+// interrupts is measured so timing problems can be seen over USB.
+//
+// Limiting the current
+// ====================
+// An oven with several elements can draw more than its circuit breaker allows if they are all on at
+// once.  prefs.maxElementsOn limits how many elements can be on at the same time (0 means no limit).
+// If the duty cycles add up to more than the limit allows they are all scaled down by the same amount,
+// so the balance between the elements is kept and the oven simply heats more slowly.
+//
+// Zero-cross burst firing
+// =======================
+// With a zero-cross detector on output 6, the elements are switched from the detector's interrupt instead,
+// at the start of each mains half-cycle.  A duty cycle of n% turns the element on for exactly n of every
+// 100 half-cycles, spread as evenly as possible: each half-cycle the duty is added to an accumulator, and
+// the element is on if the accumulator reaches 100 (which is then subtracted).  Only as many elements as
+// the total duty needs are turned on in any half-cycle.  If more are due, the ones that have waited
+// longest go first and the rest keep their accumulators and go in the next half-cycle.  Random-fire SSRs
+// then always switch at the zero crossing.  If the detector stops sending pulses the 20ms timer takes over.
 
+#define ELEMENT_TICK_MICROS      20000   // The timer interrupt fires every 20ms
+#define ELEMENT_TICK_LATE        1000    // A tick more than 1ms early or late is counted
+#define ZERO_CROSS_DEBOUNCE      6000    // Ignore pulses less than 6ms apart (a half-cycle is at least 8.3ms)
+#define ZERO_CROSS_TIMEOUT       50000   // Fall back to the timer if there hasn't been a pulse for 50ms
 
 volatile uint32_t *portAOut, *portAMode, *portBOut, *portBMode;
 static boolean outputState[NUMBER_OF_OUTPUTS];
 
+volatile boolean elementSchedulerRunning = false;
+volatile uint8_t elementDuty[NUMBER_OF_OUTPUTS];      // Duty cycle (0-100) of each output, set by the control loop
+volatile uint8_t elementWindowCounter;                // Position in the 2-second window (0-99)
+volatile uint8_t elementStart[NUMBER_OF_OUTPUTS];     // Where each output turns on in the window
+volatile uint8_t elementWindowDuty[NUMBER_OF_OUTPUTS]; // The duty cycle when the window was laid out
+volatile boolean elementOn[NUMBER_OF_OUTPUTS];        // State the scheduler wants each output in
+volatile uint32_t elementTicks, elementLastTickMicros, elementJitterTotal, elementJitterMax, elementTicksLate;
+volatile uint16_t elementAccumulator[NUMBER_OF_OUTPUTS]; // Burst firing: on for the half-cycles where this reaches 100
+boolean zeroCrossEnabled = false;
+volatile uint32_t lastZeroCrossMicros;
+
 // Initialize the registers controlling the outputs, and turn them off
 void initOutputs() {
   // Get pointer to the registers
@@ -53,6 +97,15 @@ void setOutput(uint8_t outputNumber, boolean state) {
     return;
   }
 
+  // Output 6 might be the chip-select of a second thermocouple, or an input
+  if (outputNumber == PROBE_THERMOCOUPLE_OUTPUT && isThermocoupleEnabled(THERMOCOUPLE_PROBE))
+    return;
+  if (outputNumber == ZERO_CROSS_OUTPUT && zeroCrossEnabled)
+    return;
+
+  // The timer interrupt also writes to these registers, so don't let it in half way through
+  noInterrupts();
+
   // Save the new state
   outputState[outputNumber] = state;
   
@@ -99,6 +152,7 @@ void setOutput(uint8_t outputNumber, boolean state) {
         *portBOut |= SETBIT11; 
       break;
   }
+  interrupts();
 }
 
 
@@ -128,9 +182,12 @@ void setOvenOutputs(boolean elementsOn, boolean convectionFanOn, boolean cooling
         setOutput(i, coolingFanOn);
         break;
       default:
-        // This can only be used to turn the elements off
-        if (!elementsOn)
+        // This can only be used to turn the elements off.  Stop the scheduler turning them back on
+        if (!elementsOn) {
+          elementDuty[i] = 0;
+          elementOn[i] = false;
           setOutput(i, LOW);
+        }
         break;
     }
   }
@@ -177,9 +234,228 @@ uint8_t numOutputsConfigured()
 {
   uint8_t numberConfigured = 0;
   for (uint8_t i=0; i< NUMBER_OF_OUTPUTS; i++) {
-    if (prefs.outputType[i] != TYPE_UNUSED)
+    if (prefs.outputType[i] != TYPE_UNUSED && prefs.outputType[i] < TYPE_ZERO_CROSS)
       numberConfigured++;
   }
   return numberConfigured;
 }
 
+
+
+// Start switching the heating elements from the timer interrupt.  The elements start off
+void startElementScheduler()
+{
+  noInterrupts();
+  for (uint8_t i=0; i< NUMBER_OF_OUTPUTS; i++) {
+    elementDuty[i] = 0;
+    elementWindowDuty[i] = 0;
+    elementStart[i] = 0;
+    elementOn[i] = false;
+    elementAccumulator[i] = 0;
+  }
+  elementWindowCounter = 0;
+  elementTicks = 0;
+  elementJitterTotal = 0;
+  elementJitterMax = 0;
+  elementTicksLate = 0;
+  elementSchedulerRunning = true;
+  interrupts();
+  if (prefs.maxElementsOn)
+    SerialUSB.println("No more than " + String(prefs.maxElementsOn) + " element(s) will be on at a time");
+}
+
+
+// Stop switching the elements, turn them off and show how accurate the timing was
+void stopElementScheduler()
+{
+  elementSchedulerRunning = false;
+  for (uint8_t i=0; i< NUMBER_OF_OUTPUTS; i++) {
+    if (isHeatingElement(prefs.outputType[i]))
+      setOutput(i, LOW);
+  }
+  if (elementTicks > 1) {
+    sprintf(buffer100Bytes, "Element timing%s: %lu ticks, jitter average %luus, max %luus, %lu late",
+            isZeroCrossActive()? " (zero-cross)": "", elementTicks, elementJitterTotal / (elementTicks - 1), elementJitterMax, elementTicksLate);
+    SerialUSB.println(buffer100Bytes);
+  }
+}
+
+
+// Set the duty cycle (0-100) of each type of heating element.  If the elements would need to be on at
+// the same time more than prefs.maxElementsOn allows, all the duty cycles are scaled down
+void setElementDuties(uint8_t bottomDuty, uint8_t topDuty, uint8_t boostDuty)
+{
+  uint8_t duty[NUMBER_OF_OUTPUTS];
+  uint16_t totalDuty = 0;
+  uint8_t i;
+
+  for (i=0; i< NUMBER_OF_OUTPUTS; i++) {
+    switch (prefs.outputType[i]) {
+      case TYPE_BOTTOM_ELEMENT:
+        duty[i] = bottomDuty < 100? bottomDuty: 100;
+        break;
+      case TYPE_TOP_ELEMENT:
+        duty[i] = topDuty < 100? topDuty: 100;
+        break;
+      case TYPE_BOOST_ELEMENT:
+        duty[i] = boostDuty < 100? boostDuty: 100;
+        break;
+      default:
+        duty[i] = 0;
+        break;
+    }
+    totalDuty += duty[i];
+  }
+
+  // The windows are laid end to end, so the total duty is what sets the most elements on at once
+  if (prefs.maxElementsOn && totalDuty > prefs.maxElementsOn * 100) {
+    for (i=0; i< NUMBER_OF_OUTPUTS; i++)
+      duty[i] = (uint16_t) duty[i] * prefs.maxElementsOn * 100 / totalDuty;
+  }
+
+  for (i=0; i< NUMBER_OF_OUTPUTS; i++) {
+    if (isHeatingElement(prefs.outputType[i]))
+      elementDuty[i] = duty[i];
+  }
+}
+
+
+// Lay the on-times of the elements end to end around the 2-second window, wrapping past the end.  Called
+// from the timer interrupt at the start of each window
+void layoutElementWindows()
+{
+  uint8_t start = 0;
+
+  for (uint8_t i=0; i< NUMBER_OF_OUTPUTS; i++) {
+    if (!isHeatingElement(prefs.outputType[i]))
+      continue;
+    elementStart[i] = start;
+    elementWindowDuty[i] = elementDuty[i];
+    start = (start + elementDuty[i]) % 100;
+  }
+}
+
+
+// Measure how far this tick is from when it should have happened
+void recordElementTick(uint32_t now, uint32_t expectedMicros)
+{
+  if (elementTicks) {
+    uint32_t interval = now - elementLastTickMicros;
+    uint32_t jitter = interval > expectedMicros? interval - expectedMicros : expectedMicros - interval;
+    elementJitterTotal += jitter;
+    if (jitter > elementJitterMax)
+      elementJitterMax = jitter;
+    if (jitter > ELEMENT_TICK_LATE)
+      elementTicksLate++;
+  }
+  elementLastTickMicros = now;
+  elementTicks++;
+}
+
+
+// Called from the timer interrupt every 20ms.  Switch the elements and measure the time since the last call
+void updateElementOutputs()
+{
+  if (!elementSchedulerRunning || isZeroCrossActive())
+    return;
+  recordElementTick(micros(), ELEMENT_TICK_MICROS);
+
+  if (elementWindowCounter == 0)
+    layoutElementWindows();
+
+  for (uint8_t i=0; i< NUMBER_OF_OUTPUTS; i++) {
+    if (!isHeatingElement(prefs.outputType[i]))
+      continue;
+    // The output is on from its start until the duty cycle has been used.  A lower duty cycle takes
+    // effect straight away (the elements might have been turned off), and a higher one in the next window
+    uint8_t position = (elementWindowCounter + 100 - elementStart[i]) % 100;
+    elementOn[i] = position < elementWindowDuty[i] && position < elementDuty[i];
+    // Write the output every time, in case something else changed it
+    setOutput(i, elementOn[i]);
+  }
+  elementWindowCounter = (elementWindowCounter + 1) % 100;
+}
+
+
+// Use output 6 as the zero-cross input, if it has been configured that way.  Called on startup and
+// whenever the type of output 6 is changed
+void initZeroCross()
+{
+  boolean enable = (prefs.outputType[ZERO_CROSS_OUTPUT] == TYPE_ZERO_CROSS);
+  if (enable == zeroCrossEnabled)
+    return;
+
+  if (enable) {
+    pinMode(ZERO_CROSS_PIN, INPUT_PULLUP);
+    lastZeroCrossMicros = micros() - ZERO_CROSS_TIMEOUT;
+    zeroCrossEnabled = true;
+    attachInterrupt(digitalPinToInterrupt(ZERO_CROSS_PIN), zeroCrossHandler, RISING);
+  }
+  else {
+    // Stop listening, and drive output 6 as an ordinary output again
+    detachInterrupt(digitalPinToInterrupt(ZERO_CROSS_PIN));
+    zeroCrossEnabled = false;
+    pinMode(ZERO_CROSS_PIN, OUTPUT);
+    setOutput(ZERO_CROSS_OUTPUT, LOW);
+  }
+}
+
+
+// Are the zero-cross pulses arriving?
+boolean isZeroCrossActive()
+{
+  return zeroCrossEnabled && micros() - lastZeroCrossMicros < ZERO_CROSS_TIMEOUT;
+}
+
+
+// Interrupt handler for the zero-cross detector.  Called at the start of every mains half-cycle
+void zeroCrossHandler()
+{
+  uint32_t now = micros();
+  uint16_t totalDuty = 0;
+  uint8_t i, allowed, next;
+
+  // Ignore noise on the input
+  if (now - lastZeroCrossMicros < ZERO_CROSS_DEBOUNCE)
+    return;
+  lastZeroCrossMicros = now;
+
+  if (!elementSchedulerRunning)
+    return;
+  recordElementTick(now, prefs.lineVoltageFrequency == CR0_NOISE_FILTER_60HZ? 8333 : 10000);
+
+  // Spread the half-cycles evenly across every 100
+  for (i=0; i< NUMBER_OF_OUTPUTS; i++) {
+    elementOn[i] = false;
+    if (!isHeatingElement(prefs.outputType[i]))
+      continue;
+    elementAccumulator[i] += elementDuty[i];
+    // An element that keeps being deferred only ever catches up by one half-cycle
+    if (elementAccumulator[i] > 200)
+      elementAccumulator[i] = 200;
+    totalDuty += elementDuty[i];
+  }
+
+  // Turn on no more elements than the total duty needs, taking the ones that have waited longest first
+  allowed = (totalDuty + 99) / 100;
+  if (prefs.maxElementsOn && allowed > prefs.maxElementsOn)
+    allowed = prefs.maxElementsOn;
+  while (allowed--) {
+    next = NUMBER_OF_OUTPUTS;
+    for (i=0; i< NUMBER_OF_OUTPUTS; i++) {
+      if (!isHeatingElement(prefs.outputType[i]) || elementOn[i] || elementDuty[i] == 0 || elementAccumulator[i] < 100)
+        continue;
+      if (next == NUMBER_OF_OUTPUTS || elementAccumulator[i] > elementAccumulator[next])
+        next = i;
+    }
+    if (next == NUMBER_OF_OUTPUTS)
+      break;
+    elementOn[next] = true;
+    elementAccumulator[next] -= 100;
+  }
+
+  for (i=0; i< NUMBER_OF_OUTPUTS; i++) {
+    if (isHeatingElement(prefs.outputType[i]))
+      setOutput(i, elementOn[i]);
+  }
+}
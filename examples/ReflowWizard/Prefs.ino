@@ -14,6 +14,7 @@
 
 uint8_t lastPrefsBlock = 0;
 uint32_t timeOfLastSavePrefsRequest = 0;
+uint8_t profilesNotConverted = 0;     // Old profiles that must be read from the SD card again
 
 void getPrefs() 
 {
@@ -69,6 +70,25 @@ void getPrefs()
     prefs.lastUsedProfileBlock = FIRST_PROFILE_BLOCK;
   }
 
+  // Touchscreen calibration used to be 8 corner readings.  Convert them to the calibration matrix
+  if (!isTouchCalibrated() && prefs.topLeftX != 0) {
+    touch.calibrate(prefs.topLeftX,prefs.topRightX,prefs.bottomLeftX,prefs.bottomRightX,prefs.topLeftY,prefs.bottomLeftY,prefs.topRightY,prefs.bottomRightY);
+    touch.getCalibration(prefs.touchCalibration);
+    savePrefs();
+  }
+
+  // Profiles used to be stored as variable-length tokens.  Convert them to bytecode.  Any that can't be
+  // converted are deleted, and must be read from the SD card again (deleting a profile moves the next
+  // one into its place)
+  for (uint8_t i=0; i < prefs.numProfiles; ) {
+    if (openProfile(i) || convertOldProfile(i))
+      i++;
+    else {
+      deleteProfile(i);
+      profilesNotConverted++;
+    }
+  }
+
   SerialUSB.println("Read prefs from block " + String(prefsToUse) + ". Seq No=" + String(prefs.sequenceNumber) + " size=" + String(sizeof(prefs)));
 
   // Remember which block was last used to save prefs
@@ -146,13 +166,13 @@ void factoryReset(boolean saveTouchCalibrationData)
   uint32_t sequenceNumber = prefs.sequenceNumber;
   
   // Save the touchscreen calibration data
-  memcpy(buffer100Bytes, &prefs.topLeftX, 16);
+  memcpy(buffer100Bytes, prefs.touchCalibration, sizeof(prefs.touchCalibration));
   flash.factoryReset(); 
   // Get the factory-default prefs from flash
   getPrefs();
   // Restore the touchscreen data if touchscreen calibration data should be saved
   if (saveTouchCalibrationData)
-    memcpy(&prefs.topLeftX, buffer100Bytes, 16);
+    memcpy(prefs.touchCalibration, buffer100Bytes, sizeof(prefs.touchCalibration));
   // Restore sequence number
   prefs.sequenceNumber = sequenceNumber;
   writePrefsToFlash();
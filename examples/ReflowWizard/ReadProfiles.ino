@@ -12,39 +12,51 @@ char *tokenString[NUM_TOKENS] = {(char *) "not_a_token", (char *) "name", (char
                                  (char *) "cooling fan on", (char *) "cooling fan off", (char *) "ramp temperature", (char *) "element duty cycle",
                                  (char *) "wait for", (char *) "wait until above", (char *) "wait until below", (char *) "play tune", (char *) "play beep",
                                  (char *) "door percentage", (char *) "maintain", (char *) "user taps screen", (char *) "show graph", (char *) "graph divider",
-                                 (char *) "start plotting", (char *) "title"};
+                                 (char *) "start plotting", (char *) "title", (char *) "thermocouple"};
 char *tokenPtr[NUM_TOKENS];
 
+// Profile files are parsed from a buffer holding a whole SD block, instead of reading a character at a time
+Controleo3FileReader profileReader;
+
+// The TXT files found during this scan, and the ones found by the previous scan
+profileIndexEntry *profileIndex, *oldProfileIndex;
+uint8_t profileIndexCount, oldProfileIndexCount;
+// Path of the directory being scanned, relative to the root directory
+char profilePath[MAX_PROFILE_PATH_LENGTH + 1];
+
 // Scan the SD card, looking for profiles
 void ReadProfilesFromSDCard()
 {
   // Don't do anything if there isn't a SD card
-  if (digitalRead(A0) == HIGH)
+  if (!SD.cardPresent())
     return;
   SerialUSB.println("SD card is present");
 
-  // Initialize the SD card
-  SerialUSB.println("Initializing SD card...");
-  // Try initializing twice.  Necessary if good card follows bad one
-  if (!SD.begin() && !SD.begin()) {
+  // Mount the SD card.  This does nothing if it is still mounted from earlier
+  if (!SD.begin()) {
     SerialUSB.println((char *) "Card failed, or not present");
     SerialUSB.println((char *) "Error! Is SD card FAT16 or FAT32?");
     tft.fillRect(20, 120, 440, 40, WHITE);
     displayString(24, 120, FONT_9PT_BLACK_ON_WHITE, (char *) "Error! Is SD card FAT16 or FAT32?");
     uint32_t start = millis();
     // Display the message for 3 seconds, or until the SD card is removed
-    while (digitalRead(A0) == LOW && millis() - start < 3000)
+    while (SD.cardPresent() && millis() - start < 3000)
       delay(20);
     tft.fillRect(20, 120, 440, 40, WHITE);
     // Don't do anything more
     return;
   }
-  SerialUSB.println("SD Card initialized");
+  SerialUSB.println("SD Card mounted");
 
   // Open the root folder to look for files
   File root = SD.open("/");
 
+  uint32_t startTime = millis();
+  loadProfileIndex();
+  profilePath[0] = 0;
   processDirectory(root);
+  saveProfileIndex();
+  SerialUSB.println("Profiles read in " + String(millis() - startTime) + "ms");
 
   // Profiles are written to flash as part of the factory setup.  Write these immediately
   if (prefs.sequenceNumber < 10)
@@ -52,58 +64,95 @@ void ReadProfilesFromSDCard()
 }
 
 
-// Look for profile files in this directory
+// Look for profile files in this directory.  profilePath holds the path of this directory.
+// Entries are read straight from the directory, so files that aren't profiles are never opened
 void processDirectory(File dir)
 {
-  while (true) {
-    File entry =  dir.openNextFile();
-    if (!entry) {
-      // No more files.  Close the directory now
-      dir.close();
-      return;
+  dir_t entry;
+  char name[13];
+  uint8_t pathLength = strlen(profilePath);
+  profileIndexEntry indexEntry;
+
+  while (dir.readDir(&entry) > 0) {
+    SdFile::dirName(entry, name);
+    // Skip anything nested too deeply to fit in the path buffer
+    if (pathLength + strlen(name) + 1 > MAX_PROFILE_PATH_LENGTH)
+      continue;
+    strcpy(profilePath + pathLength, name);
+
+    // If this is a directory then process it (uses recursion).  The subdirectory is closed by processDirectory
+    if (DIR_IS_SUBDIR(&entry)) {
+      File subdir = dir.openEntry(&entry);
+      if (subdir) {
+        strcat(profilePath, "/");
+        processDirectory(subdir);
+      }
+      continue;
     }
 
-    // If this is a directory then process it (uses recursion)
-    if (entry.isDirectory())
-      processDirectory(entry);
-    else {
-      // Only look at TXT files
-      if (strstr(entry.name(), ".TXT"))
-        processFile(entry);
+    // Only look at TXT files
+    if (!strstr(name, ".TXT"))
+      continue;
+
+    // Has this file been scanned before?
+    indexEntry.pathHash = hashString(profilePath);
+    indexEntry.firstCluster = ((uint32_t) entry.firstClusterHigh << 16) | entry.firstClusterLow;
+    indexEntry.fileSize = entry.fileSize;
+    indexEntry.modifiedDate = entry.lastWriteDate;
+    indexEntry.modifiedTime = entry.lastWriteTime;
+    if (!isFileInProfileIndex(&indexEntry)) {
+      // This is a new or changed file, so it needs to be read.  If it can't be opened, or there wasn't
+      // room to store its profile, leave it out of the index so the next scan tries it again
+      File file = dir.openEntry(&entry);
+      if (!file)
+        continue;
+      indexEntry.profileHash = processFile(file);
+      file.close();
+      if (indexEntry.profileHash == PROFILE_TRY_AGAIN)
+        continue;
     }
-    entry.close();
+    addToProfileIndex(&indexEntry);
   }
+
+  // No more files.  Close the directory now
+  profilePath[pathLength] = 0;
+  dir.close();
 }
 
 
-// Process a file with a TXT extension
-void processFile(File file)
+// Process a file with a TXT extension.  Returns the hash of the profile name, 0 if the file
+// isn't a profile or had errors, or PROFILE_TRY_AGAIN if there was no room to store the profile
+uint32_t processFile(File file)
 {
   profiles *newProfile = 0;
-  char c;
+  uint8_t i;
   uint16_t numbers[4];  // Array used to store numbers read from the file
   uint8_t token;
+  uint32_t profileHash;
+  uint32_t errorResult = 0;
   
   // Some sanity checks on the file before processing it
   if (file.size() < 100)
-    return;
+    return 0;
   // The file must start with "Controleo3"
-  if (file.read(buffer100Bytes, 10) != 10)
-    return;
+  profileReader.begin(&file);
+  for (i = 0; i < 10; i++)
+    buffer100Bytes[i] = profileReader.next();
   buffer100Bytes[10] = 0;
   if (strcmp(buffer100Bytes, "Controleo3") != 0)
-    return;
+    return 0;
 
   // Looks like this is a valid profile file
   SerialUSB.println("Processing file: " + String(file.name()));
 
-  // Reset the token search
+  // Reset the token search and the checks done on each instruction
   initTokenPtrs();
+  startProfileVerify();
 
   // Keep reading characters until the entire file has been processed
-  while (file.available()) {
+  while (profileReader.available()) {
     // See if this character resulted in a token being found
-    token = hasTokenBeenFound(file.read());
+    token = hasTokenBeenFound(profileReader.next());
     if (token == NOT_A_TOKEN)
         continue;
 
@@ -115,12 +164,12 @@ void processFile(File file)
       case TOKEN_NAME:
         // Has a name been extracted from the file already?
         if (newProfile) {
-          SerialUSB.println("Profile has more than one name!");
+          profileError("Profile has more than one name!");
           goto tokenError;
         }
         // Get the name of the profile
-        if (!getStringFromFile(file, buffer100Bytes, MAX_PROFILE_NAME_LENGTH)) {
-          SerialUSB.println("Unable to find profile name");
+        if (!getStringFromFile(buffer100Bytes, MAX_PROFILE_NAME_LENGTH)) {
+          profileError("Unable to find profile name");
           goto tokenError;
         }
 
@@ -129,7 +178,8 @@ void processFile(File file)
 
         // Is there a spare profile slot?
         if (prefs.numProfiles >= MAX_PROFILES) {
-          SerialUSB.println("No space to store profile");
+          profileError("No space to store profile");
+          errorResult = PROFILE_TRY_AGAIN;
           goto tokenError;
         }
 
@@ -141,48 +191,52 @@ void processFile(File file)
         
         // Allocate the first flash block to this profile
         newProfile->startBlock = getFreeProfileBlock();
-        if (!newProfile->startBlock)
+        if (!newProfile->startBlock) {
+          errorResult = PROFILE_TRY_AGAIN;
           goto tokenError;
+        }
 
         // The flash block should be erased already - but make sure
         flash.eraseProfileBlock(newProfile->startBlock);
         
         prefs.lastUsedProfileBlock = newProfile->startBlock;
-        initProfileWriteToFlash(newProfile->startBlock);
+        if (!initProfileWriteToFlash(newProfile->startBlock)) {
+          errorResult = PROFILE_TRY_AGAIN;
+          goto tokenError;
+        }
 
         newProfile->noOfTokens = 0;
         newProfile->peakTemperature = 0;
+        verifyInstruction(token, NULL);
         break;
 
       case TOKEN_COMMENT1:
       case TOKEN_COMMENT2:
         // Discard everything until a new line character
-        while (file.available()) {
-          c = file.read();
-          if (c == 0x0A || c == 0x0D)
-            break;
-        }
+        profileReader.readUntil(0x0A, NULL, 0, true);
         break;
 
       case TOKEN_DISPLAY:
         // This should be followed by a string that should be displayed
-        if (!getStringFromFile(file, buffer100Bytes, MAX_PROFILE_DISPLAY_STR)) {
-          SerialUSB.println("Error getting display string");
+        if (!getStringFromFile(buffer100Bytes, MAX_PROFILE_DISPLAY_STR)) {
+          profileError("Error getting display string");
           goto tokenError;
         }
         // Save the display string
-        saveTokenAndStringToFlash(token, buffer100Bytes);
+        if (!saveTokenAndStringToFlash(token, buffer100Bytes))
+          goto tokenError;
         newProfile->noOfTokens++;
         break;
 
       case TOKEN_TITLE:
         // This should be followed by a string that should be displayed
-        if (!getStringFromFile(file, buffer100Bytes, MAX_PROFILE_TITLE_STR)) {
-          SerialUSB.println("Error getting title string");
+        if (!getStringFromFile(buffer100Bytes, MAX_PROFILE_TITLE_STR)) {
+          profileError("Error getting title string");
           goto tokenError;
         }
         // Save the title string
-        saveTokenAndStringToFlash(token, buffer100Bytes);
+        if (!saveTokenAndStringToFlash(token, buffer100Bytes))
+          goto tokenError;
         newProfile->noOfTokens++;
         break;
 
@@ -190,20 +244,21 @@ void processFile(File file)
       case TOKEN_ELEMENT_DUTY_CYCLES:
       case TOKEN_BIAS:
         // This should be followed by 3 numbers, indicating bottom/top/boost
-        if (!getNumberFromFile(file, &numbers[0])) {
-          SerialUSB.println("Error getting number 1/3");
+        if (!getNumberFromFile(&numbers[0])) {
+          profileError("Error getting number 1/3");
           goto tokenError;
         }
-        if (!getNumberFromFile(file, &numbers[1])) {
-          SerialUSB.println("Error getting number 2/3");
+        if (!getNumberFromFile(&numbers[1])) {
+          profileError("Error getting number 2/3");
           goto tokenError;
         }
-        if (!getNumberFromFile(file, &numbers[2])) {
-          SerialUSB.println("Error getting number 3/3");
+        if (!getNumberFromFile(&numbers[2])) {
+          profileError("Error getting number 3/3");
           goto tokenError;
         }
         // Save the token and numbers to flash
-        saveTokenAndNumbersToFlash(token, numbers, 3);
+        if (!saveTokenAndNumbersToFlash(token, numbers, 3))
+          goto tokenError;
         newProfile->noOfTokens++;
         break;
 
@@ -212,16 +267,17 @@ void processFile(File file)
       case TOKEN_MAINTAIN_TEMP:
       case TOKEN_SHOW_GRAPH:
         // These should be followed by 2 numbers
-        if (!getNumberFromFile(file, &numbers[0])) {
-          SerialUSB.println("Error getting number 1/2");
+        if (!getNumberFromFile(&numbers[0])) {
+          profileError("Error getting number 1/2");
           goto tokenError;
         }
-        if (!getNumberFromFile(file, &numbers[1])) {
-          SerialUSB.println("Error getting number 2/2");
+        if (!getNumberFromFile(&numbers[1])) {
+          profileError("Error getting number 2/2");
           goto tokenError;
         }
         // Save the token and numbers to flash
-        saveTokenAndNumbersToFlash(token, numbers, 2);
+        if (!saveTokenAndNumbersToFlash(token, numbers, 2))
+          goto tokenError;
         newProfile->noOfTokens++;
         // This could be the peak temperature
         if (numbers[0] > newProfile->peakTemperature)
@@ -238,13 +294,21 @@ void processFile(File file)
       case TOKEN_WAIT_UNTIL_BELOW_C:
       case TOKEN_GRAPH_DIVIDER:
       case TOKEN_START_PLOTTING:
+      case TOKEN_THERMOCOUPLE:
         // These require 1 parameter
-        if (!getNumberFromFile(file, &numbers[0])) {
-          SerialUSB.println("Error getting number");
+        if (!getNumberFromFile(&numbers[0])) {
+          profileError("Error getting number");
+          goto tokenError;
+        }
+        // Thermocouples are numbered from 1, like the outputs
+        if (token == TOKEN_THERMOCOUPLE && (numbers[0] < 1 || numbers[0] > NUM_THERMOCOUPLES)) {
+          sprintf(buffer100Bytes, "Thermocouple must be 1 to %d", NUM_THERMOCOUPLES);
+          profileError(buffer100Bytes);
           goto tokenError;
         }
         // Save the oven open/close to flash
-        saveTokenAndNumbersToFlash(token, numbers, 1);
+        if (!saveTokenAndNumbersToFlash(token, numbers, 1))
+          goto tokenError;
         newProfile->noOfTokens++;
         // This could be the peak temperature
         if (token == TOKEN_WAIT_UNTIL_ABOVE_C && numbers[0] > newProfile->peakTemperature)
@@ -261,22 +325,25 @@ void processFile(File file)
       case TOKEN_PLAY_BEEP:
       case TOKEN_TAP_SCREEN:
         // Just save the token to flash.  These don't take parameters
-        saveTokenAndNumbersToFlash(token, numbers, 0);
+        if (!saveTokenAndNumbersToFlash(token, numbers, 0))
+          goto tokenError;
         newProfile->noOfTokens++;
         break;
     } 
   }
 
   // Done reading the file
-  // Save the tokens in the profile to flash.  There might be an error if there were too many tokens in the file
-  if (!writeTokenBufferToFlash(true))
+  // Write the rest of the profile and its header to flash
+  if (!finishProfileWriteToFlash())
     goto tokenError;
     
+  // Remember the profile name before sorting moves the profile
+  profileHash = newProfile? hashString(newProfile->name) : 0;
   // Sort the profiles to keep them in alphabetical order.  This also updates prefs.numProfiles
   sortProfiles();
   // Save the preferences
   savePrefs();
-  return;
+  return profileHash;
 
 tokenError:
   // If there was any error, throw the entire thing away.  Better that the user see that the profile
@@ -284,11 +351,108 @@ tokenError:
   // Unfortunately this doesn't take into account incorrectly spelt or ordered tokens (e.g. "door close" instead of "close door")
   
   // Delete this profile
+  endProfileWriteToFlash();
   deleteProfile(prefs.numProfiles);
 
   // Save the profiles
   savePrefs();
   SerialUSB.println("Error processing file - discarded");
+  showProfileError(file.name());
+  return errorResult;
+}
+
+
+// Read the index written by the last scan, and get ready to build the new one
+void loadProfileIndex()
+{
+  profileIndexCount = 0;
+  oldProfileIndexCount = 0;
+  profileIndex = (profileIndexEntry *) malloc(PROFILE_INDEX_SIZE * sizeof(profileIndexEntry));
+  oldProfileIndex = (profileIndexEntry *) malloc(PROFILE_INDEX_SIZE * sizeof(profileIndexEntry));
+  // Without memory for both, every file is scanned
+  if (!profileIndex || !oldProfileIndex) {
+    freeProfileIndex();
+    return;
+  }
+
+  File indexFile = SD.open(PROFILE_INDEX_FILE);
+  if (!indexFile)
+    return;
+  int bytesRead = indexFile.read(oldProfileIndex, PROFILE_INDEX_SIZE * sizeof(profileIndexEntry));
+  if (bytesRead > 0)
+    oldProfileIndexCount = bytesRead / sizeof(profileIndexEntry);
+  indexFile.close();
+}
+
+
+// Write the new index to the SD card if anything changed
+void saveProfileIndex()
+{
+  if (profileIndex && (profileIndexCount != oldProfileIndexCount ||
+      memcmp(profileIndex, oldProfileIndex, profileIndexCount * sizeof(profileIndexEntry)) != 0)) {
+    SD.remove((char *) PROFILE_INDEX_FILE);
+    File indexFile = SD.open(PROFILE_INDEX_FILE, FILE_WRITE);
+    if (indexFile) {
+      indexFile.write((uint8_t *) profileIndex, profileIndexCount * sizeof(profileIndexEntry));
+      indexFile.close();
+    }
+    SerialUSB.println("Profile index updated");
+  }
+  freeProfileIndex();
+}
+
+
+// Release the memory used by the profile index
+void freeProfileIndex()
+{
+  free(profileIndex);
+  free(oldProfileIndex);
+  profileIndex = 0;
+  oldProfileIndex = 0;
+  profileIndexCount = 0;
+  oldProfileIndexCount = 0;
+}
+
+
+// Has this file been scanned before, without changing since?  If it held a profile then
+// the profile must still be in flash; the user may have deleted it since the last scan
+boolean isFileInProfileIndex(profileIndexEntry *entry)
+{
+  for (uint8_t i = 0; i < oldProfileIndexCount; i++) {
+    profileIndexEntry *oldEntry = &oldProfileIndex[i];
+    // Everything up to the profile hash must match
+    if (memcmp(oldEntry, entry, offsetof(profileIndexEntry, profileHash)) != 0)
+      continue;
+    entry->profileHash = oldEntry->profileHash;
+    if (!entry->profileHash)
+      return true;
+    for (uint8_t j = 0; j < prefs.numProfiles; j++) {
+      if (hashString(prefs.profile[j].name) == entry->profileHash)
+        return true;
+    }
+    return false;
+  }
+  return false;
+}
+
+
+// Remember this file in the new index
+void addToProfileIndex(profileIndexEntry *entry)
+{
+  if (profileIndex && profileIndexCount < PROFILE_INDEX_SIZE)
+    memcpy(&profileIndex[profileIndexCount++], entry, sizeof(profileIndexEntry));
+}
+
+
+// FNV-1a hash of a string.  This never returns 0 or PROFILE_TRY_AGAIN, so they can be used to mean "no hash"
+uint32_t hashString(char *str)
+{
+  uint32_t hash = 2166136261UL;
+  while (*str) {
+    hash ^= (uint8_t) *str++;
+    hash *= 16777619UL;
+  }
+  return (hash && hash != PROFILE_TRY_AGAIN)? hash : 1;
 }
 
 
@@ -327,97 +491,36 @@ uint8_t hasTokenBeenFound(char c)
 }
 
 
-// Read a string from the file.  The string must be contained inside double-quotes.
+// Read a string from the profile file.  The string must be contained inside double-quotes.
 // Return false if the end-of-file is reached before the second double-quote is read.
 // Only save up to the maximum string length, and ignore (discard) any characters over
 // the maximum length
-boolean getStringFromFile(File file, char *strBuffer, uint8_t maxLength)
+boolean getStringFromFile(char *strBuffer, uint8_t maxLength)
 {
-  boolean doubleQuoteFound = false;
-  char c;
-
-  // Empty string so far
-  memset(strBuffer, 0, maxLength + 1);
-  
-  while (file.available()) {
-    c = file.read();
-    // Is this the first double-quote (the start of the string)?
-    if (!doubleQuoteFound) {
-      if (c == '"') 
-        doubleQuoteFound = true;
-      continue;
-    }
-
-    // Is this the second double-quote (the end of the string)?
-    if (doubleQuoteFound && c == '"') {
-      // Terminate the string
-      *strBuffer = 0;
-      return true;
-    }
+  // Skip everything up to the first double-quote (the start of the string)
+  if (!profileReader.readUntil('"', NULL, 0))
+    return false;
 
-    // Have we come to the end of the line without finding a double-quote?
-    if (c == 0x0A || c == 0x0D) {
-      SerialUSB.println("Missing double-quote of string");
-      return false;
-    }
-    
-    // Save this character if the max length hasn't been exceeded
-    if (maxLength) {
-      *strBuffer++ = c;
-      maxLength--;
-    }
+  // The string ends with the second double-quote, which must be on the same line
+  if (!profileReader.readUntil('"', strBuffer, maxLength, true)) {
+    SerialUSB.println("Missing double-quote of string");
+    return false;
   }
-  // We've reached the end of the file
-  return false;
+  return true;
 }
 
 
-// Read a number from the file.  This method doesn't care what the delimiter is; it just 
+// Read a number from the profile file.  This method doesn't care what the delimiter is; it just 
 // reads until it finds a digit, and continues until it finds something that isn't a
 // digit.  This reads uint16_t numbers, so they are limited to 65,536 (2^16).
-// Return false if the end-of-file is reached before the number is found.
-boolean getNumberFromFile(File file, uint16_t *num)
+// Return false if the end of the line or file is reached before the number is found.
+boolean getNumberFromFile(uint16_t *num)
 {
-  boolean digitFound = false;
-  char c;
-
-  *num = 0;
-  
-  while (file.available()) {
-    c = file.read();
-      
-    if (!digitFound) {
-      // Have we come to the end of the line without finding a digit?
-      if (c == 0x0A || c == 0x0D) {
-        SerialUSB.println("Can't find number");
-        return false;
-      }
-
-      // Is this the first digit?
-      if (isdigit(c)) {
-        digitFound = true;
-        *num = c - '0';
-        continue;
-      }
-
-      // This isn't a digit, and we haven't found one yet.  Keep looking
-      continue;
-    }
-
-    // We have found a number already.  Is this the delimiter?
-    if (!isdigit(c))
-      return true;
-
-    // We have found another digit of the number
-    *num = (*num * 10) + c - '0';
-  }
-  
-  // We've reached the end of the file
-  if (digitFound) {
-      SerialUSB.println("Found number " + String(*num));
-      return true;
+  if (!profileReader.readNumber(num)) {
+    SerialUSB.println("Can't find number");
+    return false;
   }
-  return false;
+  return true;
 }
 
 
@@ -504,238 +607,396 @@ char *tokenToText(char *str, uint8_t token, uint16_t *numbers)
     case TOKEN_TAP_SCREEN:
       strcpy(str, "User taps screen");
       break;
+    case TOKEN_THERMOCOUPLE:
+      sprintf(str, "Use thermocouple %d", numbers[0]);
+      break;
   }
   return str;  
 }
 
 
 uint16_t startFlashBlock;
-uint16_t offsetIntoBlock;
-uint16_t numBlocksUsed;
+profileHeader writeHeader;
+uint8_t *stringPage = NULL;
 
-// Initialize all the variables needed to write the profile to flash
-void initProfileWriteToFlash(uint16_t startingBlock) {
+// Initialize all the variables needed to write the profile to flash.  Instructions are collected
+// in flashBuffer256Bytes and strings in stringPage, and each page is written to flash when it is full
+boolean initProfileWriteToFlash(uint16_t startingBlock) {
   startFlashBlock = startingBlock;
-  offsetIntoBlock = 0;
-  numBlocksUsed = 0;
+  writeHeader.magic = PROFILE_BYTECODE_MAGIC;
+  writeHeader.numInstructions = 0;
+  writeHeader.numStrings = 0;
+
+  // Unused bytes are left as 0xFF, the same as erased flash
+  memset(flashBuffer256Bytes, 0xFF, 256);
+  if (!stringPage)
+    stringPage = (uint8_t *) malloc(256);
+  if (!stringPage)
+    return false;
+  memset(stringPage, 0xFF, 256);
+  return true;
+}
+
 
-  // Clear the buffer used to save the profile
-  memset(flashBuffer256Bytes, 0, 256);
+// Is there space in the profile's flash for this many instructions and strings?
+boolean profileHasSpaceFor(uint16_t numInstructions, uint16_t numStrings)
+{
+  uint16_t instructionPages = (numInstructions + PROFILE_INSTRUCTIONS_PER_PAGE - 1) / PROFILE_INSTRUCTIONS_PER_PAGE;
+  uint16_t stringPages = (numStrings + PROFILE_STRINGS_PER_PAGE - 1) / PROFILE_STRINGS_PER_PAGE;
+  // The first page holds the header
+  return 1 + instructionPages + stringPages <= PROFILE_SIZE_IN_BLOCKS;
 }
 
 
-// Save the token and its parameters to flash
-void saveTokenAndNumbersToFlash(uint8_t token, uint16_t *numbers, uint8_t numOfNumbers)
+// Write a page of the profile to flash
+void writeProfilePage(uint16_t page, uint8_t *buf)
 {
-  // Show the token being written for debugging
-  SerialUSB.println(tokenToText(buffer100Bytes, token, numbers));
+  // Unprotect flash so writing can take place
+  flash.allowWritingToPrefs(true);
+  flash.write(startFlashBlock + page, 256, buf);
+  // Protect flash again
+  flash.allowWritingToPrefs(false);
+  SerialUSB.println("Wrote profile flash block " + String(startFlashBlock + page));
+}
+
+
+// Add an instruction to the profile
+boolean addInstructionToFlash(uint8_t token, uint16_t *numbers, uint8_t numOfNumbers)
+{
+  profileInstruction instruction;
+  uint16_t page = 1 + writeHeader.numInstructions / PROFILE_INSTRUCTIONS_PER_PAGE;
+  uint16_t slot = writeHeader.numInstructions % PROFILE_INSTRUCTIONS_PER_PAGE;
 
-  // Is this the end of the block?
-  if (offsetIntoBlock > (256 - MAX_TOKEN_LENGTH)) {
-    flashBuffer256Bytes[offsetIntoBlock] = TOKEN_NEXT_FLASH_BLOCK;
-    writeTokenBufferToFlash(false);
+  if (!profileHasSpaceFor(writeHeader.numInstructions + 1, writeHeader.numStrings)) {
+    return profileError("Profile file is too long");
   }
 
-  // Save the token
-  flashBuffer256Bytes[offsetIntoBlock++] = token;
-  // Save the numbers
-  for (uint8_t i=0; i< numOfNumbers; i++) {
-    memcpy(flashBuffer256Bytes + offsetIntoBlock, numbers + i, 2);
-    offsetIntoBlock += 2;
+  memset(&instruction, 0, sizeof(instruction));
+  instruction.token = token;
+  for (uint8_t i=0; i< numOfNumbers; i++)
+    instruction.param[i] = numbers[i];
+  // flashBuffer256Bytes isn't aligned for 16-bit access, so copy the instruction in
+  memcpy(flashBuffer256Bytes + slot * PROFILE_INSTRUCTION_SIZE, &instruction, PROFILE_INSTRUCTION_SIZE);
+  writeHeader.numInstructions++;
+
+  // Is this page full?
+  if (slot == PROFILE_INSTRUCTIONS_PER_PAGE - 1) {
+    writeProfilePage(page, flashBuffer256Bytes);
+    memset(flashBuffer256Bytes, 0xFF, 256);
   }
+  return true;
+}
+
+
+// Save the token and its parameters to flash
+boolean saveTokenAndNumbersToFlash(uint8_t token, uint16_t *numbers, uint8_t numOfNumbers)
+{
+  // Make sure this instruction will work when the profile runs
+  if (!verifyInstruction(token, numbers))
+    return false;
+
+  // Show the token being written for debugging
+  SerialUSB.println(tokenToText(buffer100Bytes, token, numbers));
+
+  return addInstructionToFlash(token, numbers, numOfNumbers);
 }
 
 
-// Save a string to flash.  "Display" and "Title" take a string as
-// a parameter.  The string is saved null-terminated.
-void saveTokenAndStringToFlash(uint16_t token, char *str)
+// Save a string to flash.  "Display" and "Title" take a string as a parameter.  The string
+// is saved null-terminated in the next string slot, and the instruction refers to the slot
+boolean saveTokenAndStringToFlash(uint16_t token, char *str)
 {
+  if (!verifyInstruction(token, NULL))
+    return false;
+
   // Show the token being written for debugging
   if (token == TOKEN_DISPLAY)
     SerialUSB.println("Display \"" + String(str) + "\"");
   else
     SerialUSB.println("Title \"" + String(str) + "\"");
 
-  // Is this the end of the block?
-  if (offsetIntoBlock > (256 - MAX_TOKEN_LENGTH)) {
-    flashBuffer256Bytes[offsetIntoBlock] = TOKEN_NEXT_FLASH_BLOCK;
-    writeTokenBufferToFlash(false);
+  return addStringToFlash(token, str);
+}
+
+
+// Add an instruction that takes a string to the profile
+boolean addStringToFlash(uint8_t token, char *str)
+{
+  uint16_t slot = writeHeader.numStrings;
+
+  if (!profileHasSpaceFor(writeHeader.numInstructions + 1, writeHeader.numStrings + 1)) {
+    return profileError("Profile file is too long");
   }
-  
-  // Save the token
-  flashBuffer256Bytes[offsetIntoBlock++] = token;
+
   // Save the string
-  strcpy((char *) flashBuffer256Bytes + offsetIntoBlock, str);
-  offsetIntoBlock+= strlen(str) + 1;
+  strncpy((char *) stringPage + (slot % PROFILE_STRINGS_PER_PAGE) * PROFILE_STRING_SIZE, str, PROFILE_STRING_SIZE - 1);
+  stringPage[(slot % PROFILE_STRINGS_PER_PAGE) * PROFILE_STRING_SIZE + PROFILE_STRING_SIZE - 1] = 0;
+  writeHeader.numStrings++;
+
+  // Is this page full?  String pages are used from the last page downwards
+  if (slot % PROFILE_STRINGS_PER_PAGE == PROFILE_STRINGS_PER_PAGE - 1) {
+    writeProfilePage(PROFILE_SIZE_IN_BLOCKS - 1 - slot / PROFILE_STRINGS_PER_PAGE, stringPage);
+    memset(stringPage, 0xFF, 256);
+  }
+
+  // Save the instruction
+  return addInstructionToFlash(token, &slot, 1);
 }
 
 
-// Write the 256-byte profile block to flash
-boolean writeTokenBufferToFlash(boolean endOfProfile)
+// Write the partially-filled pages and the header to flash.  The header is written last so a
+// profile that was only partly written is never mistaken for a good one
+boolean finishProfileWriteToFlash()
 {
-  // Is this the end of the profile?
-  if (endOfProfile)
-    flashBuffer256Bytes[offsetIntoBlock] = TOKEN_END_OF_PROFILE;
-  // Is this the last available block?  Profiles can take 16 blocks = 16 x 256-bytes = 4K
-  if (numBlocksUsed == 15)
-    flashBuffer256Bytes[offsetIntoBlock] = TOKEN_END_OF_PROFILE;
-  
-  if (numBlocksUsed < 16) {
-    // Unprotect flash so writing can take place
-    flash.allowWritingToPrefs(true);
-    // Write the 256-byte block of tokens (only have 4K = 16x256 blocks available)
-    flash.write(startFlashBlock + numBlocksUsed, 256, flashBuffer256Bytes);
-    // Protect flash again
-    flash.allowWritingToPrefs(false);
-    SerialUSB.println("Wrote profile flash block " + String(startFlashBlock + numBlocksUsed) + "   size (bytes) = " + String(offsetIntoBlock));
-  }
+  // Was a profile being written?
+  if (!stringPage)
+    return true;
 
-  // Initialize all the variables used to store the tokens
-  numBlocksUsed++;
-  offsetIntoBlock = 0;
-  memset(flashBuffer256Bytes, 0, 256);
+  if (writeHeader.numInstructions % PROFILE_INSTRUCTIONS_PER_PAGE)
+    writeProfilePage(1 + writeHeader.numInstructions / PROFILE_INSTRUCTIONS_PER_PAGE, flashBuffer256Bytes);
+  if (writeHeader.numStrings % PROFILE_STRINGS_PER_PAGE)
+    writeProfilePage(PROFILE_SIZE_IN_BLOCKS - 1 - writeHeader.numStrings / PROFILE_STRINGS_PER_PAGE, stringPage);
 
-  if (numBlocksUsed > 16) {
-    SerialUSB.println("ERROR: Some tokens have been discarded!  Profile file is too long");
-    return false;
-  }
+  flash.allowWritingToPrefs(true);
+  flash.write(startFlashBlock, sizeof(profileHeader), (uint8_t *) &writeHeader);
+  flash.allowWritingToPrefs(false);
+  SerialUSB.println("Profile has " + String(writeHeader.numInstructions) + " instructions and " + String(writeHeader.numStrings) + " strings");
+
+  endProfileWriteToFlash();
   return true;
 }
 
 
-// Get the next token from flash.  If str is smaller than 512 then it is the first
-// block number and the flash reading must be initialized to that block.  It's
-// a bit hacky, but means we can use reduced-scope static variables.
-uint16_t getNextTokenFromFlash(char *str, uint16_t *num)
+// Free the buffer used to write profiles to flash
+void endProfileWriteToFlash()
+{
+  free(stringPage);
+  stringPage = NULL;
+}
+
+
+// Profiles used to be stored as variable-length tokens, packed into 256-byte pages.  Get the token at
+// offset in the old profile, and move offset past it.  Any numbers the token doesn't take are zero
+uint8_t getOldProfileToken(uint8_t *oldProfile, uint16_t *offset, char *str, uint16_t *num)
 {
-  uint16_t token;
-  static uint16_t startBlock, offset, blocksRead = 0;
-  // Need to use this buffer to ensure it lies on the 16-bit boundary to allow 16-bit access
+  uint8_t token, numOfNumbers;
+  uint16_t length;
 
-  // Is this the start of the profile reading?
-  if (!str && *num < 512) {
-    startBlock = *num;
-    offset = 0;
-    blocksRead = 0;
+  memset(num, 0, 3 * sizeof(uint16_t));
+  while (*offset < PROFILE_SIZE_IN_BLOCKS * 256) {
+    token = oldProfile[*offset];
+    numOfNumbers = 0;
+    switch (token) {
+      case TOKEN_DISPLAY:
+      case TOKEN_TITLE:
+        // The string is null-terminated, and never crosses into the next page
+        for (length = 0; ; length++) {
+          if (((*offset + 1 + length) & 0xFF) == 0)
+            return TOKEN_END_OF_PROFILE;
+          if (!oldProfile[*offset + 1 + length])
+            break;
+        }
+        strncpy(str, (char *) oldProfile + *offset + 1, PROFILE_STRING_SIZE - 1);
+        str[PROFILE_STRING_SIZE - 1] = 0;
+        *offset += length + 2;
+        return token;
+
+      case TOKEN_MAX_DUTY:
+      case TOKEN_ELEMENT_DUTY_CYCLES:
+      case TOKEN_BIAS:
+        numOfNumbers++;
+        // Fall through
+      case TOKEN_TEMPERATURE_TARGET:
+      case TOKEN_OVEN_DOOR_PERCENT:
+      case TOKEN_MAINTAIN_TEMP:
+      case TOKEN_SHOW_GRAPH:
+        numOfNumbers++;
+        // Fall through
+      case TOKEN_DEVIATION:
+      case TOKEN_MAX_TEMPERATURE:
+      case TOKEN_INITIALIZE_TIMER:
+      case TOKEN_OVEN_DOOR_OPEN:
+      case TOKEN_OVEN_DOOR_CLOSE:
+      case TOKEN_WAIT_FOR_SECONDS:
+      case TOKEN_WAIT_UNTIL_ABOVE_C:
+      case TOKEN_WAIT_UNTIL_BELOW_C:
+      case TOKEN_GRAPH_DIVIDER:
+      case TOKEN_START_PLOTTING:
+      case TOKEN_THERMOCOUPLE:
+        numOfNumbers++;
+        // The numbers never cross into the next page
+        if ((*offset & 0xFF) + numOfNumbers * 2 > 0xFF)
+          return TOKEN_END_OF_PROFILE;
+        memcpy(num, oldProfile + *offset + 1, numOfNumbers * 2);
+        *offset += 1 + numOfNumbers * 2;
+        return token;
+
+      case TOKEN_START_TIMER:
+      case TOKEN_STOP_TIMER:
+      case TOKEN_CONVECTION_FAN_ON:
+      case TOKEN_CONVECTION_FAN_OFF:
+      case TOKEN_COOLING_FAN_ON:
+      case TOKEN_COOLING_FAN_OFF:
+      case TOKEN_PLAY_DONE_TUNE:
+      case TOKEN_PLAY_BEEP:
+      case TOKEN_TAP_SCREEN:
+        (*offset)++;
+        return token;
+
+      case TOKEN_NEXT_FLASH_BLOCK:
+        // The profile continues at the start of the next page
+        *offset = (*offset + 256) & ~0xFF;
+        break;
 
-    // Is the block number good?
-    if ((startBlock & 0x0F) || startBlock < 64) {
-      SerialUSB.println("getNextTokenFromFlash: Profile block number out of range " + String(startBlock));
-      return TOKEN_END_OF_PROFILE;
+      default:
+        // End of profile, or something that isn't a token
+        return TOKEN_END_OF_PROFILE;
     }
+  }
+  return TOKEN_END_OF_PROFILE;
+}
+
+
+// Convert a profile stored as variable-length tokens to bytecode, in the same flash blocks.  The old
+// profile is copied to RAM and checked before its flash is erased.  Returns false if the profile
+// can't be converted
+boolean convertOldProfile(uint8_t profileNo)
+{
+  uint16_t startBlock = prefs.profile[profileNo].startBlock;
+  uint16_t offset, numbers[3], numInstructions = 0, numStrings = 0;
+  uint8_t token, *oldProfile;
+  boolean converted;
+
+  // Is the block number good?
+  if ((startBlock & 0x0F) || startBlock < FIRST_PROFILE_BLOCK || startBlock > LAST_PROFILE_BLOCK)
+    return false;
 
-    // Read the first block from flash into memory
-    SerialUSB.println("getNextTokenFromFlash: Reading first block " + String(startBlock));
-    flash.startRead(startBlock, 256, flashBuffer256Bytes);
+  oldProfile = (uint8_t *) malloc(PROFILE_SIZE_IN_BLOCKS * 256);
+  if (!oldProfile) {
+    SerialUSB.println("convertOldProfile: Not enough memory");
+    return false;
+  }
+  for (uint8_t page = 0; page < PROFILE_SIZE_IN_BLOCKS; page++) {
+    flash.startRead(startBlock + page, 256, oldProfile + page * 256);
     flash.endRead();
+  }
 
-    // Done for now.  The next time this is called a real token will be returned
-    return NOT_A_TOKEN;
+  // Make sure the whole profile will fit before erasing it
+  for (offset = 0; (token = getOldProfileToken(oldProfile, &offset, buffer100Bytes, numbers)) != TOKEN_END_OF_PROFILE; ) {
+    numInstructions++;
+    if (token == TOKEN_DISPLAY || token == TOKEN_TITLE)
+      numStrings++;
   }
+  converted = numInstructions && profileHasSpaceFor(numInstructions, numStrings) && initProfileWriteToFlash(startBlock);
 
-  // Figure out what token parameters need to be returned
-  token = flashBuffer256Bytes[offset];
-  switch (token) {
-    case TOKEN_DISPLAY:
-    case TOKEN_TITLE:
-      strcpy(str, (char *) flashBuffer256Bytes + offset + 1);
-      offset += strlen((char *) (flashBuffer256Bytes + offset + 1)) + 2;
-      break;
+  if (converted) {
+    SerialUSB.println("Converting profile " + String(prefs.profile[profileNo].name) + " to bytecode");
+    flash.eraseProfileBlock(startBlock);
+    offset = 0;
+    while (converted && (token = getOldProfileToken(oldProfile, &offset, buffer100Bytes, numbers)) != TOKEN_END_OF_PROFILE) {
+      if (token == TOKEN_DISPLAY || token == TOKEN_TITLE)
+        converted = addStringToFlash(token, buffer100Bytes);
+      else
+        converted = addInstructionToFlash(token, numbers, 3);
+    }
+    if (converted)
+      finishProfileWriteToFlash();
+    else
+      endProfileWriteToFlash();
+  }
 
-    case TOKEN_MAX_DUTY:
-    case TOKEN_ELEMENT_DUTY_CYCLES:
-    case TOKEN_BIAS:
-      // This should be followed by 3 numbers, indicating bottom/top/boost
-      memcpy(num, flashBuffer256Bytes + offset + 1, 6);
-      offset += 7;
-      break;
- 
-    case TOKEN_TEMPERATURE_TARGET:
-    case TOKEN_OVEN_DOOR_PERCENT:
-    case TOKEN_MAINTAIN_TEMP:
-    case TOKEN_SHOW_GRAPH:
-      // This should be followed by 2 numbers
-      memcpy(num, flashBuffer256Bytes + offset + 1, 4);
-      offset += 5;
-      break;
+  free(oldProfile);
+  return converted;
+}
 
-    case TOKEN_DEVIATION:
-    case TOKEN_MAX_TEMPERATURE:
-    case TOKEN_INITIALIZE_TIMER:
-    case TOKEN_OVEN_DOOR_OPEN:
-    case TOKEN_OVEN_DOOR_CLOSE:
-    case TOKEN_WAIT_FOR_SECONDS:
-    case TOKEN_WAIT_UNTIL_ABOVE_C:
-    case TOKEN_WAIT_UNTIL_BELOW_C:
-    case TOKEN_GRAPH_DIVIDER:
-    case TOKEN_START_PLOTTING:
-      // These require 1 parameter
-      memcpy(num, flashBuffer256Bytes + offset + 1, 2);
-      offset += 3;
-      break;
-          
-    case TOKEN_START_TIMER:
-    case TOKEN_STOP_TIMER:
-    case TOKEN_CONVECTION_FAN_ON:
-    case TOKEN_CONVECTION_FAN_OFF:
-    case TOKEN_COOLING_FAN_ON:
-    case TOKEN_COOLING_FAN_OFF:
-    case TOKEN_PLAY_DONE_TUNE:
-    case TOKEN_PLAY_BEEP:
-    case TOKEN_TAP_SCREEN:
-      // These don't take parameters
-      offset ++;
-      break;
 
-    case TOKEN_END_OF_PROFILE:
-      // Nothing to do, but don't advance over this token
-      break;
+// The profile being read
+uint16_t readStartBlock;
+profileHeader readHeader;
+uint16_t cachedProfilePage;
 
-    case TOKEN_NEXT_FLASH_BLOCK:
-      // Sanity check
-      if (blocksRead++ >= 16) {
-        SerialUSB.println("getNextTokenFromFlash: Too many blocks");
-        token = TOKEN_END_OF_PROFILE;
-        break;
-      }
-      // Read the next block from flash into memory
-//      SerialUSB.println("getNextTokenFromFlash: Reading extra block " + String(startBlock+ blocksRead));
-      flash.startRead(startBlock + blocksRead, 256, flashBuffer256Bytes);
-      flash.endRead();
-      offset = 0;
-      return getNextTokenFromFlash(str, num);
-
-    default:
-      // Should never get here
-      SerialUSB.println("getNextTokenFromFlash: Unknown token " + String(token));
-      token = TOKEN_END_OF_PROFILE;
-      break;
+// Get ready to read a profile.  Returns false if the profile is invalid, or was written by an
+// older version of the firmware and needs to be read from the SD card again
+boolean openProfile(uint8_t profileNo)
+{
+  readStartBlock = prefs.profile[profileNo].startBlock;
+  cachedProfilePage = 0;
+
+  // Is the block number good?
+  if ((readStartBlock & 0x0F) || readStartBlock < FIRST_PROFILE_BLOCK || readStartBlock > LAST_PROFILE_BLOCK) {
+    SerialUSB.println("openProfile: Profile block number out of range " + String(readStartBlock));
+    return false;
+  }
+
+  flash.startRead(readStartBlock, sizeof(profileHeader), (uint8_t *) &readHeader);
+  flash.endRead();
+  if (readHeader.magic != PROFILE_BYTECODE_MAGIC || !profileHasSpaceFor(readHeader.numInstructions, readHeader.numStrings)) {
+    SerialUSB.println("openProfile: Profile is not valid bytecode");
+    return false;
   }
-  return token;
+  return true;
+}
+
+
+// Get instruction n of the open profile.  The numbers (and string, if there is one) are returned in
+// str and num.  Instructions can be fetched in any order, so callers can look ahead or resume
+uint16_t getProfileInstruction(uint16_t n, char *str, uint16_t *num)
+{
+  profileInstruction instruction;
+  uint16_t page;
+
+  if (n >= readHeader.numInstructions)
+    return TOKEN_END_OF_PROFILE;
+
+  // Read the page holding this instruction, unless it has been read already
+  page = readStartBlock + 1 + n / PROFILE_INSTRUCTIONS_PER_PAGE;
+  if (page != cachedProfilePage) {
+    flash.startRead(page, 256, flashBuffer256Bytes);
+    flash.endRead();
+    cachedProfilePage = page;
+  }
+  memcpy(&instruction, flashBuffer256Bytes + (n % PROFILE_INSTRUCTIONS_PER_PAGE) * PROFILE_INSTRUCTION_SIZE, PROFILE_INSTRUCTION_SIZE);
+  memcpy(num, instruction.param, sizeof(instruction.param));
+
+  if ((instruction.token == TOKEN_DISPLAY || instruction.token == TOKEN_TITLE) && str)
+    getProfileString(instruction.param[0], str);
+  return instruction.token;
+}
+
+
+// Read a string of the open profile into str, which must hold at least PROFILE_STRING_SIZE bytes.
+// Reads always start at a page boundary, so read the slots before this one into str too
+void getProfileString(uint16_t slot, char *str)
+{
+  *str = 0;
+  if (slot >= readHeader.numStrings)
+    return;
+  flash.startRead(readStartBlock + PROFILE_SIZE_IN_BLOCKS - 1 - slot / PROFILE_STRINGS_PER_PAGE, PROFILE_STRING_SIZE, (uint8_t *) str);
+  for (uint8_t i = slot % PROFILE_STRINGS_PER_PAGE; i; i--)
+    flash.continueRead(PROFILE_STRING_SIZE, (uint8_t *) str);
+  flash.endRead();
+  str[PROFILE_STRING_SIZE - 1] = 0;
 }
 
 
 // Dump profile for debugging
 void dumpProfile(uint8_t profileNo)
 {
-  uint16_t block, token, numbers[4];
+  uint16_t n, token, numbers[4];
   
   // Sanity check
   if (profileNo >= MAX_PROFILES)
     return;
 
-  // Get the start block of the profile.  The profile could be 16 blocks long (16 * 256 bytes = 4K)
-  block = prefs.profile[profileNo].startBlock;
-
   // Set up the profile reading
-  if (getNextTokenFromFlash(0, &block) == TOKEN_END_OF_PROFILE)
+  if (!openProfile(profileNo))
     return;
 
   SerialUSB.println("---- Start of profile ----");
 
-  while (1) {
+  for (n = 0; ; n++) {
     // Get the next token
-    token = getNextTokenFromFlash(buffer100Bytes, numbers);
+    token = getProfileInstruction(n, buffer100Bytes, numbers);
 
     // Display the token and parameters
     switch (token) {
@@ -772,6 +1033,7 @@ void dumpProfile(uint8_t profileNo)
       case TOKEN_WAIT_UNTIL_BELOW_C:
       case TOKEN_GRAPH_DIVIDER:
       case TOKEN_START_PLOTTING:
+      case TOKEN_THERMOCOUPLE:
         // These require 1 parameter
         SerialUSB.println(tokenToText(buffer100Bytes, token, numbers));
         break;
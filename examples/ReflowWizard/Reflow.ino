@@ -11,7 +11,12 @@
 #define GRAPH_HEIGHT   150 
 #define GRAPH_WIDTH    300
 
-#define CLOSE_LOG_FILE   if (logFileOpen) { logFile.close();  logFileOpen = false; }
+// Log files are preallocated for the expected length of the profile
+#define LOG_BYTES_PER_SECOND    (sizeof(logRecord))   // A record is written to the log every second
+#define LOG_OPEN_ENDED_SECONDS 300     // Allowance for steps that wait for a temperature or a tap
+#define LOG_HEADER_BYTES       (LOG_HEADER_SIZE + LOG_INDEX_ENTRIES * sizeof(logIndexEntry))  // Header and index
+
+#define CLOSE_LOG_FILE   closeLogBuffer();
 
 // Perform a reflow
 // Stay in this function until the reflow is done or canceled
@@ -20,17 +25,17 @@ void reflow(uint8_t profileNo)
   uint32_t reflowTimer = 0, countdownTimer = 0, plotSeconds = 0, secondsFromStart = 0, lastLoopTime = millis();
   uint8_t counter = 0;
   uint8_t reflowPhase = REFLOW_PHASE_NEXT_COMMAND;
-  double currentTemperature = 0, pidTemperatureDelta = 0, pidTemperature = 0;
-  uint8_t elementDutyCounter[NUMBER_OF_OUTPUTS];
+  double currentTemperature = 0, controlTemperature = 0, pidTemperatureDelta = 0, pidTemperature = 0;
+  uint8_t controlChannel = THERMOCOUPLE_OVEN;
   boolean isOneSecondInterval = false, displayGraph = false;
   uint16_t iconsX, i, token = NOT_A_TOKEN, numbers[4], maxDuty[4], currentDuty[4], bias[4];
+  uint16_t instruction = 0;
   boolean isPID = false, incrementTimer = true;
-  boolean abortDialogIsOnScreen = false, logFileOpen = false;
+  boolean abortDialogIsOnScreen = false;
   uint16_t maxTemperatureDeviation = 20, maxTemperature = 260, desiredTemperature = 0, Kd, maxBias;
   int16_t pidPower;
-  float pidPreviousError = 0, pidIntegral = 0, pidDerivative, thisError;
+  float pidPreviousError = 0, pidIntegral = 0, pidDerivative, thisError, latencyCompensation;
   uint16_t graphMaxTemp = 0, graphMaxSeconds = 0;
-  File logFile;
   
   // Verify the outputs are configured
   if (areOutputsConfigured() == false) {
@@ -47,32 +52,37 @@ void reflow(uint8_t profileNo)
   // Is SD card logging of time/temperature enabled?
   if (prefs.logToSDCard) {
     // Is the SD card inserted?
-    if (digitalRead(A0) == HIGH) {
+    if (!SD.cardPresent()) {
       showHelp(HELP_NO_SD_CARD);
       return;
     }
 
-    // Open the log file on the SD card
-    // Try initializing twice.  Necessary if good card follows bad one
-    if (!SD.begin() && !SD.begin()) {
+    // Mount the SD card.  This does nothing if it is still mounted from earlier
+    if (!SD.begin()) {
       showHelp(HELP_BAD_FORMAT);
       return;
     }
-    SerialUSB.println("SD Card initialized");
-
-    // Open the log file
-    sprintf(buffer100Bytes, "Log%05d.csv", prefs.logNumber);
-    logFile = SD.open(buffer100Bytes, FILE_WRITE);
+    SerialUSB.println("SD Card mounted");
+
+    // Open the log file.  It is preallocated so writing a record every second doesn't update the
+    // FAT and directory entry in the middle of the control loop.  The estimate uses buffer100Bytes
+    uint32_t logSize = LOG_HEADER_BYTES + estimateProfileSeconds(profileNo) * LOG_BYTES_PER_SECOND;
+    sprintf(buffer100Bytes, "Log%05d.bin", prefs.logNumber);
+    logFile = SD.openPreallocated(buffer100Bytes, logSize);
+    // If the file already exists (or the card is too fragmented) then replace it.  A binary log can't be appended to
+    if (!logFile) {
+      SD.remove(buffer100Bytes);
+      logFile = SD.open(buffer100Bytes, FILE_WRITE);
+    }
     if (!logFile) {
       SerialUSB.println("Unable to open logging file " + String(buffer100Bytes));
       showHelp(HELP_CANT_WRITE_TO_SD_CARD);
       return;
     }
 
-    // Log file has been successfully opened.  Write the name of the profile to the log file
-    logFileOpen = true;
+    // Log file has been successfully opened.  Write the header with the profile name and settings
     SerialUSB.println("Opened logging file " + String(buffer100Bytes));
-    logFile.println(prefs.profile[profileNo].name);
+    startLogBuffer(buffer100Bytes, profileNo);
 
     // Increment the file number (we don't care about wrap-around from 65536 to 0)
     prefs.logNumber++;
@@ -82,13 +92,14 @@ void reflow(uint8_t profileNo)
   SerialUSB.println("Running profile: " + String(prefs.profile[profileNo].name));
   SerialUSB.println("Power=" + String(prefs.learnedPower) + "  Inertia=" + String(prefs.learnedInertia) + "  Insulation=" + String(prefs.learnedInsulation));
 
+  // Count thermocouple faults for this run only
+  clearThermocoupleStatus();
+
   // Calculate the centered position of the heating and fan icons (icons are 32x32)
   iconsX = 240 - (numOutputsConfigured() * 20) + 4;  // (2*20) - 32 = 8.  8/2 = 4
 
-  // Stagger the element start cycle to avoid abrupt changes in current draw
-  // Simple method: there are 6 outputs but the first ones are likely the heating elements
-  for (i=0; i< NUMBER_OF_OUTPUTS; i++)
-    elementDutyCounter[i] = (65 * i) % 100;
+  // Let the timer interrupt switch the elements.  Their on-times are laid end to end (see layoutElementWindows)
+  startElementScheduler();
 
   // Default the maximum duty cycles for the elements.  These values can be overwritten by the profile file
   maxDuty[TYPE_BOTTOM_ELEMENT] = 100;
@@ -106,8 +117,9 @@ void reflow(uint8_t profileNo)
   bias[TYPE_BOOST_ELEMENT] = 50;
   maxBias = 100;
 
-  // Set up the flash reads to start with the first block of this profile
-  if (getNextTokenFromFlash(0, &prefs.profile[profileNo].startBlock) == TOKEN_END_OF_PROFILE) {
+  // Set up the flash reads for this profile
+  if (!openProfile(profileNo)) {
+    stopElementScheduler();
     CLOSE_LOG_FILE;
     return;
   }
@@ -182,9 +194,10 @@ userChangedMindAboutAborting:
         goto userChangedMindAboutAborting;
     }
     
-    // Execute this loop every 20ms (50 times per second)
+    // Execute this loop every 20ms (50 times per second).  Use the spare time to write the log
     if (millis() - lastLoopTime < 20) {
-      delay(1);
+      if (!drainLogBuffer())
+        delay(1);
       continue;
     }
     lastLoopTime += 20;
@@ -199,13 +212,9 @@ userChangedMindAboutAborting:
     // Update the reflow timer
     if (counter == 10 && !abortDialogIsOnScreen)
       displayReflowDuration(reflowTimer, displayGraph);
-    // Log data to the SD card
-    if (counter == 20 && logFileOpen) {
-      sprintf(buffer100Bytes, "%ld,%d.%02d", secondsFromStart, (uint16_t) currentTemperature, (uint16_t) ((currentTemperature - (uint16_t) currentTemperature) * 100));
-      logFile.println(buffer100Bytes);
-      // Flush the buffer (write to SD card) frequenty to prevent stutters when writing big blocks of data
-      logFile.flush();
-    }
+    // Log data to the SD card.  This only copies the readings to RAM; they're written in the spare time
+    if (counter == 20)
+      logSampleToBuffer(secondsFromStart, reflowPhase, token);
 
     // Determine if this is on a 1-second interval
     isOneSecondInterval = false;
@@ -222,8 +231,10 @@ userChangedMindAboutAborting:
     
     // Read the current temperature
     currentTemperature = getCurrentTemperature();
-    if (IS_MAX31856_ERROR(currentTemperature)) {
-      switch ((int) currentTemperature) {
+    // The profile can use a different thermocouple for wait, ramp and maintain commands
+    controlTemperature = (controlChannel == THERMOCOUPLE_OVEN)? currentTemperature: getChannelTemperature(controlChannel);
+    if (IS_MAX31856_ERROR(currentTemperature) || IS_MAX31856_ERROR(controlTemperature)) {
+      switch ((int) (IS_MAX31856_ERROR(currentTemperature)? currentTemperature: controlTemperature)) {
         case FAULT_OPEN:
           strcpy(buffer100Bytes, "Fault open (disconnected)");
           break;
@@ -256,8 +267,8 @@ userChangedMindAboutAborting:
 
     switch (reflowPhase) {
       case REFLOW_PHASE_NEXT_COMMAND:
-        // Get the next token from flash, and act on it
-        token = getNextTokenFromFlash(buffer100Bytes, numbers);
+        // Get the next instruction from flash, and act on it
+        token = getProfileInstruction(instruction++, buffer100Bytes, numbers);
 
         if (token != TOKEN_DISPLAY && token != TOKEN_TITLE)
           SerialUSB.println(tokenToText(buffer100Bytes, token, numbers));
@@ -390,6 +401,7 @@ userChangedMindAboutAborting:
               desiredTemperature = maxTemperature;
             }
             reflowPhase = REFLOW_WAITING_UNTIL_ABOVE;            
+            setTemperatureMode(TEMPERATURE_MODE_AUTO);
             updateStatusMessage(token, 0, desiredTemperature, abortDialogIsOnScreen);
             break;
             
@@ -411,6 +423,7 @@ userChangedMindAboutAborting:
               desiredTemperature = 25;
             }
             reflowPhase = REFLOW_WAITING_UNTIL_BELOW;            
+            setTemperatureMode(TEMPERATURE_MODE_AUTO);
             updateStatusMessage(token, 0, desiredTemperature, abortDialogIsOnScreen);
             break;
 
@@ -422,6 +435,8 @@ userChangedMindAboutAborting:
             desiredTemperature = pidTemperature;
 
             reflowPhase = REFLOW_MAINTAIN_TEMP;
+            // Holding a temperature favors less noise over a quick response
+            setTemperatureMode(TEMPERATURE_MODE_QUIET);
             // The temperature control is now done using PID
             isPID = true;
             pidTemperatureDelta = 0;
@@ -495,13 +510,28 @@ userChangedMindAboutAborting:
             // The temperature control is now done using PID
             isPID = true;
             // Calculate a straight line between the current temperature and the desired end temperature
-            pidTemperatureDelta = (desiredTemperature - currentTemperature) / countdownTimer;
+            pidTemperatureDelta = (desiredTemperature - controlTemperature) / countdownTimer;
             // Start the PID temperature at the current temperature
-            pidTemperature = currentTemperature;
+            pidTemperature = controlTemperature;
             // Initialize the PID variables
             pidPreviousError = 0;
             pidIntegral = 0;
             reflowPhase = REFLOW_PID;
+            // Ramps need the quickest response from the thermocouple
+            setTemperatureMode(TEMPERATURE_MODE_FAST);
+            break;
+
+          case TOKEN_THERMOCOUPLE:
+            // The following wait, ramp and maintain commands use this thermocouple
+            if (!isThermocoupleEnabled(numbers[0] - 1)) {
+              SerialUSB.println("ERROR: thermocouple " + String(numbers[0]) + " is not available!");
+              sprintf(buffer100Bytes, "Thermocouple %d is not available.", numbers[0]);
+              showReflowError(iconsX, buffer100Bytes, (char *) "Is output 6 the probe?");
+              reflowPhase = REFLOW_ALL_DONE;
+              break;
+            }
+            controlChannel = numbers[0] - 1;
+            controlTemperature = getChannelTemperature(controlChannel);
             break;
 
           case TOKEN_TAP_SCREEN:
@@ -548,7 +578,7 @@ userChangedMindAboutAborting:
           break;
 
         // We were waiting for the oven temperature to rise above a certain point
-        if (currentTemperature >= desiredTemperature) {
+        if (controlTemperature >= desiredTemperature) {
           SerialUSB.println("Heated to desired temperature");
           // Erase the status
           updateStatusMessage(NOT_A_TOKEN, 0, 0, abortDialogIsOnScreen);
@@ -563,7 +593,7 @@ userChangedMindAboutAborting:
           break;
 
         // We were waiting for the oven temperature to drop below a certain point
-        if (currentTemperature <= desiredTemperature) {
+        if (controlTemperature <= desiredTemperature) {
           SerialUSB.println("Cooled to desired temperature");
           // Erase the status
           updateStatusMessage(NOT_A_TOKEN, 0, 0, abortDialogIsOnScreen);
@@ -588,7 +618,7 @@ userChangedMindAboutAborting:
         }
 
         // Is the oven over the desired temperature?
-        if (currentTemperature >= desiredTemperature) {
+        if (controlTemperature >= desiredTemperature) {
           // Turn all the elements off
           currentDuty[TYPE_BOTTOM_ELEMENT] = 0;
           currentDuty[TYPE_TOP_ELEMENT] = 0;
@@ -610,7 +640,7 @@ userChangedMindAboutAborting:
         // Has the desired temperature been reached?  Go to the next phase then
         // The PID phase terminates when the temperature is reached, not when the
         // timer reaches zero.
-        if (currentTemperature > desiredTemperature) {
+        if (controlTemperature > desiredTemperature) {
           // Erase the status
           updateStatusMessage(NOT_A_TOKEN, 0, 0, abortDialogIsOnScreen);
           // Get the next command
@@ -620,14 +650,18 @@ userChangedMindAboutAborting:
         
         // Calculate what the expected temperature should be at this point
         pidTemperature += pidTemperatureDelta;
+
+        // The temperature reading lags behind the oven.  Compare it to what the target was when the
+        // reading was taken, otherwise PID will keep adding power during a ramp
+        latencyCompensation = pidTemperatureDelta * getTemperatureLatency(controlChannel) / 1000.0;
       
         // Abort if deviated too far from the required temperature
-        if (reflowPhase == REFLOW_PID && abs(pidTemperature - currentTemperature) > maxTemperatureDeviation && pidTemperature < desiredTemperature) {
+        if (reflowPhase == REFLOW_PID && fabs(pidTemperature - latencyCompensation - controlTemperature) > maxTemperatureDeviation && pidTemperature < desiredTemperature) {
           // Open the oven door
           setServoPosition(prefs.servoOpenDegrees, 3000);
           SerialUSB.println("ERROR: temperature delta exceeds maximum allowed!");
           sprintf(buffer100Bytes, "Exceeded max deviation of %d~C.", maxTemperatureDeviation);
-          sprintf(buffer100Bytes+50, "Target = %d~C, actual = %d~C", (int) pidTemperature, (int) currentTemperature);
+          sprintf(buffer100Bytes+50, "Target = %d~C, actual = %d~C", (int) pidTemperature, (int) controlTemperature);
           showReflowError(iconsX, buffer100Bytes, buffer100Bytes+50);
           reflowPhase = REFLOW_ALL_DONE;
           break;
@@ -639,7 +673,7 @@ userChangedMindAboutAborting:
         
         // Do the PID calculation now.  The base power will be adjusted a bit based on this result
         // This is the standard PID formula, using a 1-second interval
-        thisError = pidTemperature - currentTemperature;
+        thisError = pidTemperature - latencyCompensation - controlTemperature;
         pidIntegral = pidIntegral + thisError;
         pidDerivative = thisError - pidPreviousError;
         pidPreviousError = thisError;
@@ -655,7 +689,7 @@ userChangedMindAboutAborting:
         //   elements take a very long time to heat up and cool down so this will be a much higher value.
         Kd = map(constrain(prefs.learnedInertia, 30, 100), 30, 100, 30, 75);
         // Dump these values out over USB for debugging
-        SerialUSB.println("T="+String(currentTemperature)+" P="+String(pidTemperature)+" D="+String(pidTemperatureDelta)+" E="+String(thisError)+" I="+String(pidIntegral)+" D="+String(pidDerivative)+" Kd="+String(Kd));
+        SerialUSB.println("T="+String(controlTemperature)+" P="+String(pidTemperature)+" D="+String(pidTemperatureDelta)+" L="+String(latencyCompensation)+" E="+String(thisError)+" I="+String(pidIntegral)+" D="+String(pidDerivative)+" Kd="+String(Kd));
 
         // If we're over-temperature, it is best to slow things down even more since taking a bit longer in a phase is better than taking less time
         if (thisError < 0)
@@ -698,47 +732,20 @@ userChangedMindAboutAborting:
       case REFLOW_ABORT:
         // User either tapped "Done" at the end of the reflow, or the user tapped abort
         setOvenOutputs(ELEMENTS_OFF, CONVECTION_FAN_OFF, COOLING_FAN_OFF);
+        stopElementScheduler();
         // Close the oven door
         setServoPosition(prefs.servoClosedDegrees, 1000);
         // Stop logging
         CLOSE_LOG_FILE;
+        printThermocoupleStatus(&SerialUSB);
+        // Go back to the default thermocouple settings
+        setTemperatureMode(TEMPERATURE_MODE_NORMAL);
         // All done!
         return;
     }
  
-    // Turn the outputs on or off based on the duty cycle
-    for (i=0; i< NUMBER_OF_OUTPUTS; i++) {
-      switch (prefs.outputType[i]) {
-        case TYPE_TOP_ELEMENT:
-          // Turn the output on at 0, and off at the duty cycle value
-          if (elementDutyCounter[i] == 0 && currentDuty[TYPE_TOP_ELEMENT] > 0)
-              setOutput(i, HIGH);
-          // Turn it off at the right duty cycle
-          if (elementDutyCounter[i] >= currentDuty[TYPE_TOP_ELEMENT])
-            setOutput(i, LOW);
-          break;
-        case TYPE_BOTTOM_ELEMENT:
-          // Turn the output on at 0, and off at the duty cycle value
-          if (elementDutyCounter[i] == 0 && currentDuty[TYPE_BOTTOM_ELEMENT] > 0)
-              setOutput(i, HIGH);
-          // Turn it off at the right duty cycle
-          if (elementDutyCounter[i] >= currentDuty[TYPE_BOTTOM_ELEMENT])
-            setOutput(i, LOW);
-          break;
-          
-        case TYPE_BOOST_ELEMENT: 
-          // Turn the output on at 0, and off at the duty cycle value
-          if (elementDutyCounter[i] == 0 && currentDuty[TYPE_BOOST_ELEMENT] > 0)
-              setOutput(i, HIGH);
-          // Turn it off at the right duty cycle
-          if (elementDutyCounter[i] >= currentDuty[TYPE_BOOST_ELEMENT])
-            setOutput(i, LOW);
-          break;
-        }
-      
-        // Increment the duty counter
-        elementDutyCounter[i] = (elementDutyCounter[i] + 1) % 100;
-    }
+    // Pass the duty cycles to the element scheduler.  The timer interrupt turns the outputs on and off
+    setElementDuties(currentDuty[TYPE_BOTTOM_ELEMENT], currentDuty[TYPE_TOP_ELEMENT], currentDuty[TYPE_BOOST_ELEMENT]);
 
     // Add data to the graph plot
      if (isOneSecondInterval  && !abortDialogIsOnScreen && displayGraph) {
@@ -987,3 +994,35 @@ void drawGraphOutline(uint16_t graphMaxTemp, uint16_t graphMaxSeconds)
   displayString(GRAPH_LEFT - 40 + GRAPH_WIDTH, 300, FONT_9PT_BLACK_ON_WHITE, buffer100Bytes);
 }
 
+
+// Estimate how long a profile will run, in seconds, so the log file can be preallocated.  Steps that
+// wait for a temperature or a tap have no duration so assume a few minutes for each.  If the reflow
+// runs longer than this the log file simply grows.
+uint32_t estimateProfileSeconds(uint8_t profileNo)
+{
+  uint16_t n, token, numbers[4];
+  uint32_t seconds = 0;
+
+  // Set up the flash reads for this profile
+  if (!openProfile(profileNo))
+    return 0;
+
+  // Strings aren't needed, so don't read them
+  for (n = 0; (token = getProfileInstruction(n, NULL, numbers)) != TOKEN_END_OF_PROFILE; n++) {
+    switch (token) {
+      case TOKEN_WAIT_FOR_SECONDS:
+        seconds += numbers[0];
+        break;
+      case TOKEN_TEMPERATURE_TARGET:
+      case TOKEN_MAINTAIN_TEMP:
+        seconds += numbers[1];
+        break;
+      case TOKEN_WAIT_UNTIL_ABOVE_C:
+      case TOKEN_WAIT_UNTIL_BELOW_C:
+      case TOKEN_TAP_SCREEN:
+        seconds += LOG_OPEN_ENDED_SECONDS;
+        break;
+    }
+  }
+  return seconds;
+}
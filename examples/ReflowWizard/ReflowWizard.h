@@ -93,6 +93,8 @@
 #define SCREEN_CHOOSE_PROFILE          14
 #define SCREEN_LEARNING                15
 #define SCREEN_RESULTS                 16
+#define SCREEN_DIAGNOSTICS             17
+#define SCREEN_ELEMENT_LIMIT           18
 
 // When displaying edit arrow on the screen
 #define ONE_SETTING                    0
@@ -117,9 +119,37 @@
 #define TYPE_BOOST_ELEMENT             3
 #define TYPE_CONVECTION_FAN            4
 #define TYPE_COOLING_FAN               5
-#define NO_OF_TYPES                    6
+#define TYPE_ZERO_CROSS                6  // Input from a mains zero-cross detector (output 6 only)
+#define TYPE_PROBE_THERMOCOUPLE        7  // Chip-select of the probe thermocouple (output 6 only)
+#define NO_OF_TYPES                    8
 #define isHeatingElement(x)            (x == TYPE_TOP_ELEMENT || x == TYPE_BOTTOM_ELEMENT || x == TYPE_BOOST_ELEMENT)
 
+// Thermocouples
+// The MAX31856 on the board measures the oven air.  A second MAX31856 (for example, a probe attached
+// to the board being reflowed) can be connected to the same data lines, using output 6 as its
+// chip-select.  Output 6 must be configured as "Probe Thermocouple" for this to work.
+#define NUM_THERMOCOUPLES              2
+#define THERMOCOUPLE_OVEN              0
+#define THERMOCOUPLE_PROBE             1
+#define PROBE_THERMOCOUPLE_OUTPUT      5  // Output 6
+#define PROBE_THERMOCOUPLE_CS          SCK
+
+// Output 6 can instead be the input from a mains zero-cross detector.  The elements are then switched on
+// whole mains half-cycles (burst firing) rather than every 20ms.  Only use this with solid state relays
+#define ZERO_CROSS_OUTPUT              5  // Output 6
+#define ZERO_CROSS_PIN                 SCK
+
+// Defined in Temperature.ino, which is compiled after the files that use these
+extern const char *thermocoupleName[NUM_THERMOCOUPLES];
+extern const char *thermocoupleFaultName[NUM_SR_FAULT_BITS];
+extern volatile uint32_t thermocoupleFaultsIgnored[NUM_THERMOCOUPLES];
+
+// Thermocouple conversion settings (see setTemperatureMode).  More averaging means less noise but more latency
+#define TEMPERATURE_MODE_NORMAL        0  // 2 samples, automatic conversion.  Always used for learning
+#define TEMPERATURE_MODE_FAST          1  // 1 sample, one-shot conversion.  Lowest latency, for ramps
+#define TEMPERATURE_MODE_QUIET         2  // 16 samples, automatic conversion.  Lowest noise, for long bakes
+#define TEMPERATURE_MODE_AUTO          3  // Automatic conversion, averaging picked from the measured noise
+
 // To be used with setOvenOutputs()
 #define ELEMENTS_OFF                   0
 #define LEAVE_ELEMENTS_AS_IS           1
@@ -134,14 +164,16 @@
 #define MAX_TOP_DUTY_CYCLE             80  
 #define MAX_BOOST_DUTY_CYCLE           60
 
-const char *outputDescription[NO_OF_TYPES] = {"Unused", "Bottom Element", "Top Element", "Boost Element", "Convection Fan","Cooling Fan"};
+const char *outputDescription[NO_OF_TYPES] = {"Unused", "Bottom Element", "Top Element", "Boost Element", "Convection Fan","Cooling Fan", "Zero-Cross Input", "Probe Thermocouple"};
 const char *longOutputDescription[NO_OF_TYPES] = {
   "",
   "Controls the bottom heating element.",
   "Controls the top heating element.",
   "Controls the boost heating element.",
   "On at start, off once cooling is done.",
-  "Turns on to cool the oven."
+  "Turns on to cool the oven.",
+  "Mains zero-cross.  Elements must use SSRs.",
+  "Chip-select of a second MAX31856."
 };
 
 
@@ -212,6 +244,68 @@ struct profiles {
 #define PROFILE_SIZE_IN_BLOCKS         16     // Each profile can take 4K (16 x 256 byte blocks)
 #define LAST_PROFILE_BLOCK             (FIRST_PROFILE_BLOCK + (MAX_PROFILES * PROFILE_SIZE_IN_BLOCKS) - 1)
 
+// The profile index on the SD card remembers every TXT file that was scanned, so files that
+// haven't changed since the last scan don't have to be opened again
+#define PROFILE_INDEX_FILE             "PROFILES.IDX"
+#define PROFILE_INDEX_SIZE             64     // Maximum number of TXT files remembered
+#define MAX_PROFILE_PATH_LENGTH        80     // Longest 8.3 path that is scanned, e.g. "PROFILES/LEADFREE.TXT"
+#define PROFILE_TRY_AGAIN              0xFFFFFFFF  // processFile() couldn't store the profile, so scan the file again next time
+
+struct profileIndexEntry {
+  uint32_t pathHash;                          // Hash of the 8.3 path from the root directory
+  uint32_t firstCluster;                      // First cluster of the file
+  uint32_t fileSize;                          // Size of the file, in bytes
+  uint16_t modifiedDate;                      // FAT date the file was last written
+  uint16_t modifiedTime;                      // FAT time the file was last written
+  uint32_t profileHash;                       // Hash of the name of the profile in the file, or 0 if not a profile
+};
+
+// Reflow logs are written in a compact binary format (LOGnnnnn.BIN) and converted to CSV when the log is closed.
+// The file has a 512-byte header, then a fixed-width record for every second, then a sparse index giving
+// the file offset of the record at regular intervals.  The header is rewritten at close to point to the index
+#define LOG_FILE_MAGIC                 0x474F4C33   // "3LOG"
+#define LOG_FILE_VERSION               1
+#define LOG_HEADER_SIZE                512    // Records start in the second block
+#define LOG_NO_TEMPERATURE             -32768 // Thermocouple was disabled or had a fault
+#define LOG_INDEX_ENTRIES              64     // Maximum number of index entries
+#define LOG_INDEX_INTERVAL             16     // Seconds between index entries.  Doubled each time the index fills
+
+struct logFileHeader {
+  uint32_t magic;                             // LOG_FILE_MAGIC
+  uint16_t version;                           // LOG_FILE_VERSION
+  uint16_t recordSize;                        // sizeof(logRecord)
+  uint32_t indexOffset;                       // File offset of the index, or 0 if the log wasn't closed
+  uint16_t indexEntries;                      // Number of entries in the index
+  uint16_t indexInterval;                     // Seconds between index entries
+  uint32_t numRecords;                        // Number of records following the header
+  uint32_t samplesDropped;                    // Samples lost because the SD card couldn't keep up
+  char     profileName[MAX_PROFILE_NAME_LENGTH+1];
+  uint8_t  numThermocouples;                  // Temperatures in each record
+  uint8_t  thermocouplesEnabled;              // Bit mask of the thermocouples used for this run
+  uint8_t  outputType[NUMBER_OF_OUTPUTS];     // Snapshot of the prefs used for this run ...
+  uint8_t  lineVoltageFrequency;
+  uint8_t  servoOpenDegrees;
+  uint8_t  servoClosedDegrees;
+  uint8_t  learnedPower;
+  uint16_t learnedInertia;
+  uint16_t learnedInsulation;
+};
+
+struct logRecord {
+  uint32_t seconds;                           // Seconds since the start of the run
+  int16_t  temperature[NUM_THERMOCOUPLES];    // Tenths of a degree Celsius, or LOG_NO_TEMPERATURE
+  int16_t  coldJunction;                      // Hundredths of a degree Celsius (oven thermocouple)
+  uint8_t  faultStatus;                       // Fault status register of the oven thermocouple
+  uint8_t  phase;                             // Reflow phase (REFLOW_PHASE_NEXT_COMMAND, ...)
+  uint8_t  token;                             // Profile command being executed
+  uint8_t  reserved[3];                       // Pads the record to 16 bytes
+};
+
+struct logIndexEntry {
+  uint32_t seconds;                           // Seconds since the start of the run
+  uint32_t offset;                            // File offset of the record for this second
+};
+
 // Tokens used for profile file
 #define NOT_A_TOKEN                   0   // Used to indicate end of profile (no more tokens)
 #define TOKEN_NAME                    1   // The name of the profile (max 31 characters)
@@ -245,12 +339,33 @@ struct profiles {
 #define TOKEN_GRAPH_DIVIDER          29   // Draw a temperature line on the graph
 #define TOKEN_START_PLOTTING         30   // Start plotting the graph
 #define TOKEN_TITLE                  31   // The title that is displayed when the profile is running
+#define TOKEN_THERMOCOUPLE           32   // The thermocouple used by the following wait/ramp/maintain commands
 
-#define NUM_TOKENS                   32   // Number of tokens to look for in the profile file on the SD card
-#define TOKEN_NEXT_FLASH_BLOCK     0xFE   // Profile continues in next flash block 
+#define NUM_TOKENS                   33   // Number of tokens to look for in the profile file on the SD card
 #define TOKEN_END_OF_PROFILE       0xFF   // Safety measure.  Flash is initialized to 0xFF, so this token means end-of-profile 
+#define TOKEN_NEXT_FLASH_BLOCK     0xFE   // Profiles stored by older firmware continue in the next flash block
+
+// Profiles are compiled to bytecode when they are read from the SD card.  The first page of the profile's
+// flash holds the header.  Fixed-width instructions follow it, 32 to a page, so instruction n can be
+// fetched directly without decoding the ones before it.  Display and title strings are kept in fixed-size
+// slots starting at the last page and working down towards the instructions
+#define PROFILE_BYTECODE_MAGIC   0x33435042   // "BPC3"
+#define PROFILE_INSTRUCTION_SIZE      8
+#define PROFILE_INSTRUCTIONS_PER_PAGE (256 / PROFILE_INSTRUCTION_SIZE)
+#define PROFILE_STRING_SIZE          32   // Longest string (display) and the terminating null, rounded up
+#define PROFILE_STRINGS_PER_PAGE      (256 / PROFILE_STRING_SIZE)
+
+struct profileHeader {
+  uint32_t magic;                             // PROFILE_BYTECODE_MAGIC
+  uint16_t numInstructions;                   // Instructions following the header
+  uint16_t numStrings;                        // Strings at the end of the profile
+};
 
-#define MAX_TOKEN_LENGTH           (MAX_PROFILE_DISPLAY_STR + 5)
+struct profileInstruction {
+  uint8_t  token;                             // TOKEN_xxx
+  uint8_t  reserved;
+  uint16_t param[3];                          // The numbers, or the string slot for "display" and "title"
+};
 
 // Learning defines
 #define LEARNING_NOT_DONE             0   // Learning has not yet been done
@@ -262,7 +377,7 @@ struct Controleo3Prefs {
   uint32_t  sequenceNumber;                   // Prefs are rotated between 4 blocks in flash, each 4K in size
   uint16_t  versionNumber;                    // Version number of these prefs
   uint16_t  screenshotNumber;                 // Next file number of screenshot
-  uint16_t  topLeftX;                         // Touchscreen calibration points
+  uint16_t  topLeftX;                         // Old touchscreen calibration points (converted to touchCalibration)
   uint16_t  topRightX;
   uint16_t  bottomLeftX;
   uint16_t  bottomRightX;
@@ -292,7 +407,9 @@ struct Controleo3Prefs {
   uint16_t  lastUsedProfileBlock;             // The last block used to store a profile.  Keep cycling them to reduce flash wear
   uint8_t   logToSDCard;                      // Write reflow data to the SD card
   uint16_t  logNumber;                        // Log file sequential number
+  int32_t   touchCalibration[TOUCH_MATRIX_SIZE]; // Touchscreen calibration matrix (see Controleo3Touch.h)
+  uint8_t   maxElementsOn;                    // Most elements that can be on at the same time (0 = no limit)
 
-  uint8_t   spare[96];                        // Spare bytes that are initialized to zero.  Aids future expansion
+  uint8_t   spare[71];                        // Spare bytes that are initialized to zero.  Aids future expansion
 } prefs;
 
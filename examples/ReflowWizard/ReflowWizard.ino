@@ -18,7 +18,10 @@ SdFile root;
 Controleo3LCD tft;
 Controleo3Touch  touch;
 Controleo3Flash  flash;
+
+extern uint8_t profilesNotConverted;
 Controleo3MAX31856 thermocouple;
+Controleo3MAX31856 probeThermocouple;
 
 
 void setup(void) {
@@ -26,8 +29,7 @@ void setup(void) {
   initOutputs();
 
   // See if there is a SD card present
-  pinMode(SD_DETECT_PIN, INPUT_PULLUP);
-  if (digitalRead(SD_DETECT_PIN) == LOW) {
+  if (SD.cardPresent()) {
     // There is a SD card
     SD.begin();
 
@@ -65,21 +67,30 @@ void setup(void) {
   // Get the prefs from external flash
   getPrefs();
 
+  // Let the user know if profiles saved by older firmware couldn't be kept
+  if (profilesNotConverted) {
+    sprintf(buffer100Bytes, "%d profile%s must be read from SD card again", profilesNotConverted, profilesNotConverted == 1? "": "s");
+    displayString(20, 150, FONT_9PT_BLACK_ON_WHITE, buffer100Bytes);
+  }
+
   // Initialize the MAX31856's registers
-  thermocouple.begin();
-  initTemperature();
+  initThermocouples();
+
+  // Listen to the zero-cross detector, if there is one
+  initZeroCross();
 
   // Initialize the timer used to control the servo and read the temperature
   initializeTimer();
 
   // Start the touchscreen
   touch.begin();
+  touch.enableInterrupt();
   
   // Move the servo to the closed position
   setServoPosition(prefs.servoClosedDegrees, 1000); 
 
   // Is there touchscreen calibration data?
-  if (prefs.topLeftX != 0) {
+  if (isTouchCalibrated()) {
     sendTouchCalibrationData();
     // Show the logos for a few seconds
     delay(3000);
@@ -120,7 +131,8 @@ const char bmpHeader[54] PROGMEM = {
 void takeScreenshot() 
 {
   char buf[320 * 3];
-  // Initialize the SD card
+  uint32_t startTime;
+  // Mount the SD card, if it isn't already mounted
   if (!SD.begin()) {
     SerialUSB.println("Card failed, or not present");
     return;
@@ -134,6 +146,7 @@ void takeScreenshot()
     return;
   }
   SerialUSB.println("Writing screenshot to " + String(buf));
+  startTime = millis();
   
   // Write the bitmap header
   memcpy_P(buf, bmpHeader, 54);
@@ -153,12 +166,14 @@ void takeScreenshot()
   }
   tft.endReadBitmap();
   dataFile.close();
+  startTime = millis() - startTime;
 
   // Increase the file number for the next screenshot
   prefs.screenshotNumber = (prefs.screenshotNumber + 1) % 10000;
   savePrefs();
   playTones(TUNE_SCREENSHOT_DONE);
-  SerialUSB.println("Screenshot written!");
+  // Bytes per millisecond is the same as KB per second
+  SerialUSB.println("Screenshot written in " + String(startTime) + "ms (" + String((54 + 480UL * 320 * 3) / startTime) + " KB/s)");
 }
 
 
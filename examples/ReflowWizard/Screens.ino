@@ -5,6 +5,8 @@
 
 extern void setTouchCallback(void (*f) (), uint16_t interval);
 extern boolean drawTemperatureOnScreenNow;
+extern volatile uint32_t thermocoupleFaultsIgnored[];
+extern const char *thermocoupleFaultName[];
 
 void setTouchTemperatureUnitChangeCallback(void (*f) (boolean));
 
@@ -394,10 +396,24 @@ redraw:
           // Act on the tap
           switch(getTap(SHOW_TEMPERATURE_IN_HEADER)) {
             case 0: prefs.outputType[output] = (prefs.outputType[output] + NO_OF_TYPES - 1) % NO_OF_TYPES;
+                    // Only output 6 can be an input or a chip-select (these are the last types)
+                    if (prefs.outputType[output] >= TYPE_ZERO_CROSS && output != ZERO_CROSS_OUTPUT)
+                      prefs.outputType[output] = TYPE_COOLING_FAN;
                     savePrefs();
+                    // Output 6 might have stopped or started being an input
+                    if (output == ZERO_CROSS_OUTPUT)
+                      initZeroCross();
+                    if (output == PROBE_THERMOCOUPLE_OUTPUT)
+                      initProbeThermocouple();
                     break;
             case 1: prefs.outputType[output] = (prefs.outputType[output] + 1) % NO_OF_TYPES;
+                    if (prefs.outputType[output] >= TYPE_ZERO_CROSS && output != ZERO_CROSS_OUTPUT)
+                      prefs.outputType[output] = TYPE_UNUSED;
                     savePrefs();
+                    if (output == ZERO_CROSS_OUTPUT)
+                      initZeroCross();
+                    if (output == PROBE_THERMOCOUPLE_OUTPUT)
+                      initProbeThermocouple();
                     break;
             case 2: if (output > 0)
                       output--;
@@ -411,7 +427,7 @@ redraw:
             case 5: if (output + 1 < NUMBER_OF_OUTPUTS)
                       output++;
                     else
-                      screen = SCREEN_SERVO_OPEN;
+                      screen = SCREEN_ELEMENT_LIMIT;
                     break;
           }
           // If no longer on this screen, go to the new one
@@ -420,6 +436,53 @@ redraw:
         }
         break;
 
+      case SCREEN_ELEMENT_LIMIT:
+        // Draw the screen
+        displayHeader((char *) "Element Limit", true);
+        displayString(20, LINE(0), FONT_9PT_BLACK_ON_WHITE, (char *) "Elements on at once:");
+        drawIncreaseDecreaseTapTargets(ONE_SETTING_WITH_TEXT);
+        drawNavigationButtons(true, true);
+
+        while (1) {
+          tft.fillRect(20, LINE(1), 440, 24, WHITE);
+          if (prefs.maxElementsOn) {
+            sprintf(buffer100Bytes, "%d", prefs.maxElementsOn);
+            displayFixedWidthString(280, LINE(0), buffer100Bytes, 4, FONT_9PT_BLACK_ON_WHITE_FIXED);
+            displayString(20, LINE(1), FONT_9PT_BLACK_ON_WHITE, (char *) "Elements take turns to heat");
+          }
+          else {
+            displayFixedWidthString(280, LINE(0), (char *) "Any", 4, FONT_9PT_BLACK_ON_WHITE_FIXED);
+            displayString(20, LINE(1), FONT_9PT_BLACK_ON_WHITE, (char *) "No limit");
+          }
+
+          // Act on the tap
+          switch(getTap(SHOW_TEMPERATURE_IN_HEADER)) {
+            case 0:
+              if (prefs.maxElementsOn > 0) {
+                prefs.maxElementsOn--;
+                savePrefs();
+              }
+              else
+                playTones(TUNE_INVALID_PRESS);
+              break;
+            case 1:
+              if (prefs.maxElementsOn < NUMBER_OF_OUTPUTS - 1) {
+                prefs.maxElementsOn++;
+                savePrefs();
+              }
+              else
+                playTones(TUNE_INVALID_PRESS);
+              break;
+            case 2: output = NUMBER_OF_OUTPUTS - 1; screen = SCREEN_SETUP_OUTPUTS; break;
+            case 3: screen = SCREEN_HOME; break;
+            case 4: showHelp(SCREEN_ELEMENT_LIMIT); goto redraw;
+            case 5: screen = SCREEN_SERVO_OPEN; break;
+          }
+          if (screen != SCREEN_ELEMENT_LIMIT)
+            break;
+        }
+        break;
+
       case SCREEN_SERVO_OPEN:
         // Draw the screen
         displayHeader((char *) "Door Servo", true);
@@ -452,7 +515,7 @@ redraw:
                 playTones(TUNE_INVALID_PRESS);
               break;
               
-            case 2: screen = SCREEN_SETUP_OUTPUTS; break;
+            case 2: screen = SCREEN_ELEMENT_LIMIT; break;
             case 3: screen = SCREEN_HOME; break;
             case 4: showHelp(SCREEN_SERVO_OPEN); goto redraw;
             case 5: screen = SCREEN_SERVO_CLOSE;
@@ -626,12 +689,31 @@ redraw:
         sprintf(buffer100Bytes, "%d", prefs.numBakes);
         displayString(363, 220, FONT_9PT_BLACK_ON_WHITE, buffer100Bytes);
 
-        drawNavigationButtons(false, true);
+        drawNavigationButtons(true, true);
 
         switch(getTap(DONT_SHOW_TEMPERATURE)) {
           case 0: screen = SCREEN_SETTINGS; break;
           case 1: screen = SCREEN_HOME; break;
           case 2: showHelp(SCREEN_ABOUT); goto redraw;
+          case 3: screen = SCREEN_DIAGNOSTICS; break;
+        }
+        break;
+
+       case SCREEN_DIAGNOSTICS:
+        // Draw the screen
+        displayHeader((char *) "Thermocouple", false);
+        drawNavigationButtons(false, true);
+
+        // Update the fault counters once per second
+        setTouchIntervalCallback(displayThermocoupleDiagnostics, 1000);
+        displayThermocoupleDiagnostics();
+
+        switch(getTap(SHOW_TEMPERATURE_IN_HEADER)) {
+          case 0: screen = SCREEN_ABOUT; break;
+          case 1: screen = SCREEN_HOME; break;
+          case 2: setTouchIntervalCallback(0, 0);
+                  showHelp(SCREEN_DIAGNOSTICS);
+                  goto redraw;
         }
         break;
  
@@ -899,6 +981,8 @@ void drawTestOutputIcon(uint8_t type, boolean outputIsOn)
   // Display an icon corresponding to the output
   switch(type) {
     case TYPE_UNUSED:
+    case TYPE_ZERO_CROSS:
+    case TYPE_PROBE_THERMOCOUPLE:
       // Erase the icon that might have been there
       tft.fillRect(TEST_ICON_X, TEST_ICON_Y, 32, 32, WHITE);
       break;
@@ -934,6 +1018,50 @@ void testOutputIconAnimator()
 }
 
 
+// Display the thermocouple fault telemetry.  This is called once per second while
+// the diagnostics screen is displayed
+void displayThermocoupleDiagnostics()
+{
+  MAX31856Status status;
+  char str[20];
+
+  thermocouple.getStatus(&status);
+
+  // Cold junction temperature and the raw Fault Status Register
+  tft.fillRect(20, LINE(0), 440, 24, WHITE);
+  sprintf(buffer100Bytes, "Cold junction: %s", getTemperatureString(str, status.coldJunction, true));
+  displayString(20, LINE(0), FONT_9PT_BLACK_ON_WHITE, buffer100Bytes);
+  sprintf(buffer100Bytes, "Status: %02X", status.status);
+  displayString(320, LINE(0), FONT_9PT_BLACK_ON_WHITE, buffer100Bytes);
+
+  // Number of readings, and how many faults were hidden by the debounce logic
+  tft.fillRect(20, LINE(1), 440, 24, WHITE);
+  sprintf(buffer100Bytes, "Readings: %lu  No comms: %lu  Ignored: %lu", status.numReadings, status.noCommunication, thermocoupleFaultsIgnored[THERMOCOUPLE_OVEN]);
+  displayString(20, LINE(1), FONT_9PT_BLACK_ON_WHITE, buffer100Bytes);
+
+  // Count of each fault, and how long ago it last happened
+  for (uint8_t i=0; i< NUM_SR_FAULT_BITS; i++) {
+    uint16_t x = (i & 1)? 250: 20;
+    tft.fillRect(x, LINE(2 + i/2), 210, 24, WHITE);
+    if (status.faultCount[i])
+      sprintf(buffer100Bytes, "%s: %lu (%lus)", thermocoupleFaultName[i], status.faultCount[i], (millis() - status.lastFaultTime[i]) / 1000);
+    else
+      sprintf(buffer100Bytes, "%s: 0", thermocoupleFaultName[i]);
+    displayString(x, LINE(2 + i/2), FONT_9PT_BLACK_ON_WHITE, buffer100Bytes);
+  }
+
+  // What the SD card supports, and how fast it has been reading and writing
+  Sd2Card *card = SD.mountedCard();
+  tft.fillRect(20, LINE(6), 440, 24, WHITE);
+  if (card)
+    sprintf(buffer100Bytes, "SD: C%d %dMHz%s  R:%lu W:%lu KB/s", card->speedClass(), card->maxClockMHz(), card->isHighSpeed()? " HS" : "",
+            card->readKBPerSecond(), card->writeKBPerSecond());
+  else
+    strcpy(buffer100Bytes, "SD: not mounted");
+  displayString(20, LINE(6), FONT_9PT_BLACK_ON_WHITE, buffer100Bytes);
+}
+
+
 // Pass in an array of increasing numbers and it will return the one that "value" is just smaller than
 uint8_t mapValue(uint16_t value, uint16_t map[])
 {
@@ -3,9 +3,10 @@
 // Build a reflow oven: https://whizoo.com
 
 
-// Timer TC3 is used for 2 things:
-// 1. Take thermocouple readings every 200ms (5 times per second)
-// 2. Control the servo used to open the oven door
+// Timer TC3 is used for 3 things:
+// 1. Switch the heating elements on and off every 20ms (see Outputs.ino)
+// 2. Take thermocouple readings every 200ms (5 times per second for each thermocouple)
+// 3. Control the servo used to open the oven door
 //
 // Servo timer interrupt operation
 // ===============================
@@ -117,6 +118,9 @@ void TC3_Handler()
     // Reset the counter to zero immediately
     TC->COUNT.reg = 0;
 
+    // Switch the elements first, before the servo pulse delays everything else
+    updateElementOutputs();
+
     // Has the servo reached the desired position?
     if (servoMovements) {
       // Force the counter to zero
@@ -141,11 +145,12 @@ void TC3_Handler()
       }
     }
 
-    // Read the thermocouple 5 times per second (every 0.2 seconds)
-    if (++thermocoupleTimer >= 10) {
+    // Read each thermocouple 5 times per second (every 0.2 seconds).  Each thermocouple
+    // is read in its own 20ms slot to keep the time spent in this ISR short
+    if (++thermocoupleTimer >= 10)
       thermocoupleTimer = 0;
-      takeCurrentThermocoupleReading();
-    }
+    if (thermocoupleTimer < NUM_THERMOCOUPLES)
+      takeCurrentThermocoupleReading(thermocoupleTimer);
 
     // Clear the interrupt flag
     TC->INTFLAG.bit.MC0 = 1;
@@ -4,64 +4,248 @@
 
 
 #define CR0_INIT  (CR0_AUTOMATIC_CONVERSION + CR0_OPEN_CIRCUIT_FAULT_TYPE_K /* + CR0_NOISE_FILTER_50HZ */)
-#define CR1_INIT  (CR1_AVERAGE_2_SAMPLES + CR1_THERMOCOUPLE_TYPE_K)
+#define CR1_AVERAGING(x)  ((x) << 4)   // 0 = 1 sample, 1 = 2 samples, ... 4 = 16 samples
 #define MASK_INIT (~(MASK_VOLTAGE_UNDER_OVER_FAULT + MASK_THERMOCOUPLE_OPEN_FAULT))
 
-extern Controleo3MAX31856 thermocouple;
+extern Controleo3MAX31856 thermocouple, probeThermocouple;
 
 
 // Instead of getting instantaneous readings from the thermocouple, get an average.
 // Also, some convection ovens have noisy fans that generate spurious short-to-ground and 
 // short-to-vcc errors.  This will help to eliminate those.
 // takeCurrentThermocoupleReading() is called from the Timer 1 interrupt (see "Servo" tab).  It is
-// called 5 times per second.
+// called 5 times per second for each thermocouple.  Each thermocouple has its own 20ms slot so
+// the interrupt never reads more than one MAX31856 at a time.
 
 #define NUM_READINGS           15  // Number of readings to average the temperature over (5 readings = 1 second)
 #define ERROR_THRESHOLD        5   // Number of consecutive faults before a fault is returned
+#define JUNCTION_INTERVAL      5   // Read the cold junction temperature every 5 readings (once per second)
+#define READING_INTERVAL       200 // Milliseconds between readings of the same thermocouple
+#define NOISE_SCALE            1.95 // Mean second difference of random noise is 1.95 times its standard deviation
+#define NOISE_TARGET           0.1 // Auto mode increases averaging if the noise is above this (Celsius)
+#define NOISE_CHECK_INTERVAL   5000 // How often auto mode checks the noise (milliseconds)
+
+Controleo3MAX31856 *thermocouples[NUM_THERMOCOUPLES] = {&thermocouple, &probeThermocouple};
+const char *thermocoupleName[NUM_THERMOCOUPLES] = {"Oven", "Probe"};
+boolean thermocoupleEnabled[NUM_THERMOCOUPLES];
+
+volatile float MAX31856temperature[NUM_THERMOCOUPLES];
+volatile uint32_t thermocoupleFaultsIgnored[NUM_THERMOCOUPLES];  // Faults hidden by ERROR_THRESHOLD
+volatile float temperatureNoise[NUM_THERMOCOUPLES];  // Estimated standard deviation of the readings (Celsius)
+
+// The current conversion settings
+static uint8_t temperatureMode = TEMPERATURE_MODE_NORMAL;
+static uint8_t temperatureAveraging = 1;             // Number of samples averaged is 2^temperatureAveraging
+static volatile boolean temperatureOneShot = false;  // The ISR starts each conversion
+
+// Short names for the bits in the MAX31856 Fault Status Register (bit 0 first)
+const char *thermocoupleFaultName[NUM_SR_FAULT_BITS] = {"Open", "OV/UV", "TC low", "TC high", "CJ low", "CJ high", "TC range", "CJ range"};
+
+
+// Start the thermocouples.  This is called once, on startup
+void initThermocouples() {
+  // The thermocouple on the board is always used
+  thermocoupleEnabled[THERMOCOUPLE_OVEN] = true;
+  thermocouple.begin();
+  initTemperature();
+
+  initProbeThermocouple();
+}
+
+
+// The probe thermocouple uses output 6 as its chip-select, so it is only read if output 6 has
+// been set up for it.  A missing probe reads as NO_MAX31856.  This is called on startup and
+// whenever the type of output 6 is changed
+void initProbeThermocouple() {
+  boolean enable = (prefs.outputType[PROBE_THERMOCOUPLE_OUTPUT] == TYPE_PROBE_THERMOCOUPLE);
+  if (enable == thermocoupleEnabled[THERMOCOUPLE_PROBE])
+    return;
+
+  if (enable) {
+    probeThermocouple.begin(PROBE_THERMOCOUPLE_CS);
+    thermocoupleEnabled[THERMOCOUPLE_PROBE] = true;
+    initTemperature();
+  }
+  else {
+    // Stop reading the probe before output 6 is driven as an ordinary output again
+    thermocoupleEnabled[THERMOCOUPLE_PROBE] = false;
+    setOutput(PROBE_THERMOCOUPLE_OUTPUT, LOW);
+  }
+}
+
+
+// Is this thermocouple being read?
+boolean isThermocoupleEnabled(uint8_t channel) {
+  return channel < NUM_THERMOCOUPLES && thermocoupleEnabled[channel];
+}
 
-volatile float MAX31856temperature;
 
 // Initialize the MAX31856's registers
 void initTemperature() {
+  uint8_t cr0 = CR0_INIT + prefs.lineVoltageFrequency;
+  if (temperatureOneShot)
+    cr0 -= CR0_AUTOMATIC_CONVERSION;
+
+  // Don't let the timer interrupt read the MAX31856 halfway through writing the registers
+  noInterrupts();
   // Initializing the MAX31855's registers
-  thermocouple.writeRegister(REGISTER_CR0, CR0_INIT + prefs.lineVoltageFrequency);
-  thermocouple.writeRegister(REGISTER_CR1, CR1_INIT);
-  thermocouple.writeRegister(REGISTER_MASK, MASK_INIT);
+  for (uint8_t i=0; i< NUM_THERMOCOUPLES; i++) {
+    if (!thermocoupleEnabled[i])
+      continue;
+    thermocouples[i]->writeRegister(REGISTER_CR0, cr0);
+    thermocouples[i]->writeRegister(REGISTER_CR1, CR1_AVERAGING(temperatureAveraging) + CR1_THERMOCOUPLE_TYPE_K);
+    thermocouples[i]->writeRegister(REGISTER_MASK, MASK_INIT);
+    if (temperatureOneShot)
+      thermocouples[i]->startOneShot();
+  }
+  interrupts();
+}
+
+
+// Choose the MAX31856 averaging and conversion mode.  Ramps need a quick response, long bakes
+// benefit from less noise.  In auto mode the averaging is adjusted based on the measured noise.
+void setTemperatureMode(uint8_t mode)
+{
+  temperatureMode = mode;
+  switch (mode) {
+    case TEMPERATURE_MODE_FAST:
+      setTemperatureConversion(0, true);
+      break;
+    case TEMPERATURE_MODE_QUIET:
+      setTemperatureConversion(4, false);
+      break;
+    case TEMPERATURE_MODE_AUTO:
+      // Start with the current averaging, and adjust from there
+      setTemperatureConversion(temperatureAveraging, false);
+      break;
+    default:
+      setTemperatureConversion(1, false);
+      break;
+  }
+}
+
+
+// Write the new averaging and conversion mode to the MAX31856's, if they have changed
+void setTemperatureConversion(uint8_t averaging, boolean oneShot)
+{
+  if (averaging == temperatureAveraging && oneShot == temperatureOneShot)
+    return;
+  temperatureAveraging = averaging;
+  temperatureOneShot = oneShot;
+  initTemperature();
+  SerialUSB.println("Thermocouple: " + String(1 << averaging) + " sample(s), " + (oneShot? "one-shot": "automatic") + " conversion. Latency is " + String(getTemperatureLatency(THERMOCOUPLE_OVEN)) + "ms");
 }
 
 
-// This function is called every 200ms from the Timer 1 (servo) interrupt
-void takeCurrentThermocoupleReading()
+// In auto mode, increase the averaging if the readings are noisy and decrease it if they are quiet
+void checkTemperatureNoise()
 {
-  volatile static int readingNum = 0;
-  volatile static float recentTemperatures[NUM_READINGS];
-  volatile static int temperatureErrorCount = 0;
+  static uint32_t lastCheck = 0;
+  float noise = 0;
+
+  if (temperatureMode != TEMPERATURE_MODE_AUTO || millis() - lastCheck < NOISE_CHECK_INTERVAL)
+    return;
+  lastCheck = millis();
+
+  // Use the noisiest thermocouple
+  for (uint8_t i=0; i< NUM_THERMOCOUPLES; i++) {
+    if (thermocoupleEnabled[i] && temperatureNoise[i] > noise)
+      noise = temperatureNoise[i];
+  }
+
+  // Doubling the number of samples reduces the noise by 1.4, so leave a gap to prevent hunting
+  if (noise > NOISE_TARGET && temperatureAveraging < 4)
+    setTemperatureConversion(temperatureAveraging + 1, false);
+  else if (noise < NOISE_TARGET / 2 && temperatureAveraging > 0)
+    setTemperatureConversion(temperatureAveraging - 1, false);
+}
+
+
+// Get the time (in milliseconds) between the temperature changing and getCurrentTemperature()
+// returning the change.  The control loops can use this to compensate for the delay.
+uint16_t getTemperatureLatency(uint8_t channel)
+{
+  uint16_t conversionTime = thermocouples[channel]->getConversionTime();
+  uint16_t latency;
+
+  // The reading represents the middle of the conversion
+  if (temperatureOneShot) {
+    // The conversion was started by the previous reading
+    latency = READING_INTERVAL - (conversionTime / 2);
+  }
+  else {
+    // Automatic conversions finish, on average, half a conversion before the reading is taken
+    latency = conversionTime;
+  }
+
+  // Add the delay of the moving average
+  return latency + ((NUM_READINGS - 1) * READING_INTERVAL / 2);
+}
+
+
+// This function is called every 200ms (for each thermocouple) from the Timer 1 (servo) interrupt
+void takeCurrentThermocoupleReading(uint8_t channel)
+{
+  volatile static int readingNum[NUM_THERMOCOUPLES];
+  volatile static float recentTemperatures[NUM_THERMOCOUPLES][NUM_READINGS];
+  volatile static int temperatureErrorCount[NUM_THERMOCOUPLES];
+  volatile static int junctionCounter[NUM_THERMOCOUPLES];
+  volatile static float previousReading[NUM_THERMOCOUPLES][2];
+  volatile static uint8_t noiseReadings[NUM_THERMOCOUPLES];
+
+  if (!isThermocoupleEnabled(channel))
+    return;
     
   // The timer has fired.  It has been 0.2 seconds since the previous reading was taken
   // Take a thermocouple reading
-  float temperature = thermocouple.readThermocouple(CELSIUS);
+  float temperature = thermocouples[channel]->readThermocouple(CELSIUS);
+
+  // In one-shot mode, start the conversion for the next reading
+  if (temperatureOneShot)
+    thermocouples[channel]->startOneShot();
+
+  // Update the cold junction temperature once per second.  The library keeps it with the fault telemetry
+  if (++junctionCounter[channel] >= JUNCTION_INTERVAL) {
+    junctionCounter[channel] = 0;
+    thermocouples[channel]->readJunction(CELSIUS);
+  }
   
   // Is there an error?
   if (IS_MAX31856_ERROR(temperature)) {
     // Noise can cause spurious short faults.  These are typically caused by the convection fan
-    if (temperatureErrorCount < ERROR_THRESHOLD)
-      temperatureErrorCount++;
+    if (temperatureErrorCount[channel] < ERROR_THRESHOLD) {
+      temperatureErrorCount[channel]++;
+      thermocoupleFaultsIgnored[channel]++;
+    }
     else
-      MAX31856temperature = temperature;
+      MAX31856temperature[channel] = temperature;
   }
   else {
+    // Estimate the noise from the second difference of the readings, so a steady ramp isn't counted
+    // as noise.  Conversions with lots of averaging take longer than 200ms; skip repeated readings.
+    if (temperature != previousReading[channel][0]) {
+      if (noiseReadings[channel] >= 2) {
+        float secondDifference = temperature - (2 * previousReading[channel][0]) + previousReading[channel][1];
+        temperatureNoise[channel] += ((fabs(secondDifference) / NOISE_SCALE) - temperatureNoise[channel]) / 16;
+      }
+      else
+        noiseReadings[channel]++;
+      previousReading[channel][1] = previousReading[channel][0];
+      previousReading[channel][0] = temperature;
+    }
+
     // There is no error.  Save the temperature
-    recentTemperatures[readingNum] = temperature;
-    readingNum = (readingNum + 1) % NUM_READINGS;
+    recentTemperatures[channel][readingNum[channel]] = temperature;
+    readingNum[channel] = (readingNum[channel] + 1) % NUM_READINGS;
 
     // Calculate the average over the readings
     temperature = 0;
     for (int i=0; i< NUM_READINGS; i++)
-      temperature += recentTemperatures[i];
-    MAX31856temperature = temperature / NUM_READINGS;
+      temperature += recentTemperatures[channel][i];
+    MAX31856temperature[channel] = temperature / NUM_READINGS;
     
     // Clear any previous error
-    temperatureErrorCount = 0;
+    temperatureErrorCount[channel] = 0;
   }
 }
 
@@ -107,33 +291,86 @@ float getCurrentTemperature() {
     // Return the temperature
   return temperature;
 }
+
+
+// Only the oven temperature is simulated
+float getChannelTemperature(uint8_t channel) {
+  return getCurrentTemperature();
+}
 #else
-// Routine used by the main app to get temperatures
+// Routine used by the main app to get the oven temperature
 float getCurrentTemperature() {
-  static float temperature = 0;
-  static uint32_t lastUpdate = 0;
+  // This is called often, so it is a good place to adjust the averaging
+  checkTemperatureNoise();
+  return getChannelTemperature(THERMOCOUPLE_OVEN);
+}
+
+
+// Routine used by the main app to get temperatures
+float getChannelTemperature(uint8_t channel) {
+  static float temperature[NUM_THERMOCOUPLES];
+  static uint32_t lastUpdate[NUM_THERMOCOUPLES];
   float temperature2;
 
+  // A thermocouple that isn't connected can't be read
+  if (!isThermocoupleEnabled(channel))
+    return NO_MAX31856;
+
   // Don't take the reading too often
-  if (millis() - lastUpdate < 200)
-    return temperature;
-  lastUpdate = millis();
+  if (millis() - lastUpdate[channel] < 200)
+    return temperature[channel];
+  lastUpdate[channel] = millis();
 
   // The temperature might be updated by the ISR while reading the value.  Take
   // the reading twice to make sure the right value was obtained.
   // Now that "Plan B" is in place (see Servo) we could disable interrupts while
   // taking a reading - but this works so why change it?
   do {
-    temperature = MAX31856temperature;
-    temperature2 = MAX31856temperature;
-  } while (temperature != temperature2);
+    temperature[channel] = MAX31856temperature[channel];
+    temperature2 = MAX31856temperature[channel];
+  } while (temperature[channel] != temperature2);
 
   // Return the temperature
-  return temperature;
+  return temperature[channel];
 }
 #endif
 
 
+// Start counting thermocouple faults from zero
+void clearThermocoupleStatus()
+{
+  for (uint8_t i=0; i< NUM_THERMOCOUPLES; i++) {
+    thermocouples[i]->clearStatus();
+    thermocoupleFaultsIgnored[i] = 0;
+  }
+}
+
+
+// Print the thermocouple fault counters to the USB port or a log file
+void printThermocoupleStatus(Print *p)
+{
+  MAX31856Status status;
+
+  for (uint8_t channel=0; channel< NUM_THERMOCOUPLES; channel++) {
+    if (!thermocoupleEnabled[channel])
+      continue;
+    thermocouples[channel]->getStatus(&status);
+    sprintf(buffer100Bytes, "%s thermocouple: readings=%lu no-comms=%lu ignored=%lu CJ=%s%d.%02d", thermocoupleName[channel], status.numReadings,
+            status.noCommunication, thermocoupleFaultsIgnored[channel], status.coldJunction < 0? "-": "", (uint16_t) fabs(status.coldJunction),
+            (uint16_t) (fabs(status.coldJunction) * 100) % 100);
+    p->println(buffer100Bytes);
+    sprintf(buffer100Bytes, "  Noise=%d.%03d latency=%dms", (uint16_t) temperatureNoise[channel], (uint16_t) (temperatureNoise[channel] * 1000) % 1000, getTemperatureLatency(channel));
+    p->println(buffer100Bytes);
+    for (uint8_t i=0; i< NUM_SR_FAULT_BITS; i++) {
+      if (status.faultCount[i] == 0)
+        continue;
+      sprintf(buffer100Bytes, "  %s: %lu (last at %lus)", thermocoupleFaultName[i], status.faultCount[i], status.lastFaultTime[i] / 1000);
+      p->println(buffer100Bytes);
+    }
+  }
+}
+
+
 // Convert the temperature to a string
 char *getTemperatureString(char *str, float temperature, boolean displayInCelsius)
 {
@@ -127,27 +127,18 @@ restart:
     }
 
     // Done with collecting touch points now
-    // Calculate the extremes of the touch panel
-    // The X-axis is 480 pixels with targets at 40 and 440 
-    int16_t fourtyPixels = (topLeftX - topRightX) / 10;
-    prefs.topLeftX = topLeftX + fourtyPixels;
-    prefs.topRightX = topRightX - fourtyPixels;
-
-    fourtyPixels = (bottomLeftX - bottomRightX) / 10;
-    prefs.bottomLeftX = bottomLeftX + fourtyPixels;
-    prefs.bottomRightX = bottomRightX - fourtyPixels;
-
-    // The Y-axis is 320 pixels, with targets at 40 and 280
-    fourtyPixels = (topLeftY - bottomLeftY) / 6;
-    prefs.topLeftY = topLeftY + fourtyPixels;
-    prefs.bottomLeftY = bottomLeftY - fourtyPixels;
-  
-    fourtyPixels = (topRightY - bottomRightY) / 6;
-    prefs.topRightY = topRightY + fourtyPixels;
-    prefs.bottomRightY = bottomRightY - fourtyPixels;
-
-    // Send the calibration data to the touch driver
-    sendTouchCalibrationData();
+    // Fit the calibration matrix to all 5 points
+    {
+      int16_t rawX[5] = {topLeftX, topRightX, bottomRightX, bottomLeftX, centerX};
+      int16_t rawY[5] = {topLeftY, topRightY, bottomRightY, bottomLeftY, centerY};
+      int16_t screenX[5] = {40, 440, 440, 40, 240};
+      int16_t screenY[5] = {40, 40, 280, 280, 160};
+      if (!touch.calibrate(rawX, rawY, screenX, screenY, 5)) {
+        displayString(183, 240, FONT_9PT_BLACK_ON_WHITE, (char *) "Try again!");
+        continue;
+      }
+    }
+    touch.getCalibration(prefs.touchCalibration);
 
     // Erase the text on the screen
     tft.fillRect(125, 10, 230, 50, WHITE);
@@ -277,7 +268,14 @@ void calibrationDebounce()
 // Send the calibration data to the touch driver
 void sendTouchCalibrationData()
 {
-    touch.calibrate(prefs.topLeftX,prefs.topRightX,prefs.bottomLeftX,prefs.bottomRightX,prefs.topLeftY,prefs.bottomLeftY,prefs.topRightY,prefs.bottomRightY);
+    touch.setCalibration(prefs.touchCalibration);
+}
+
+
+// Has the touchscreen been calibrated?  Screen X always depends on the raw X or Y reading
+boolean isTouchCalibrated()
+{
+  return prefs.touchCalibration[0] != 0 || prefs.touchCalibration[1] != 0;
 }
 
 
@@ -355,7 +353,8 @@ int8_t getTap(uint8_t mode)
     // See if prefs should be written to flash.  The write is time-delayed to reduce flash write cycles
     checkIfPrefsShouldBeWrittenToFlash();
 
-    // Poll for valid tap reading
+    // Poll for valid tap reading.  The PEN_IRQ interrupt queues touches, so this returns
+    // immediately (without reading the touch controller) if the screen hasn't been touched
     if (!touch.read(&x, &y))  {
       // Exit if this is all the calling function wanted
       if (mode == CHECK_FOR_TAP_THEN_EXIT)
@@ -59,8 +59,8 @@ void animateIcons(uint16_t x)
   }
   
   for (int8_t i=0; i < NUMBER_OF_OUTPUTS; i++) {
-    // Don't display anything if the output is unused
-    if (prefs.outputType[i] == TYPE_UNUSED)
+    // Don't display anything if the output is unused (or is an input)
+    if (prefs.outputType[i] == TYPE_UNUSED || prefs.outputType[i] >= TYPE_ZERO_CROSS)
       continue;
     // Handle heating elements first
     if (isHeatingElement(prefs.outputType[i])) {
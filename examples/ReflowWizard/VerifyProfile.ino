@@ -0,0 +1,180 @@
+// Written by Peter Easton
+// Released under the MIT license
+// Build a reflow oven: https://whizoo.com
+
+
+// Verifying profiles
+// ==================
+// Mistakes in a profile used to be found in the middle of a reflow, with the oven already hot.  Some
+// were only reported over USB and the firmware carried on with a substitute value.  Now every instruction
+// is checked as the profile is read from the SD card.  The checker follows the state that reflow() will
+// be in: the maximum temperature and duty cycles, whether PID is controlling the elements, and whether
+// the elements are on at all.  A profile with a mistake is rejected, and the line number and reason are
+// shown on the screen and sent over USB.
+
+boolean verifyHasName;                          // "name" must come first
+boolean verifyIsPID;                            // A ramp or maintain is controlling the elements
+boolean verifyElementsOn;                       // "element duty cycle" turned at least one element on
+uint16_t verifyMaxTemperature;
+uint16_t verifyMaxDuty[4];                      // Indexed by TYPE_BOTTOM_ELEMENT, like reflow()
+uint16_t verifyTarget;                          // The temperature the oven was last heated to
+char profileErrorMessage[50];
+uint16_t profileErrorLine;
+
+
+// Get ready to verify a new profile.  These are the defaults used by reflow()
+void startProfileVerify()
+{
+  verifyHasName = false;
+  verifyIsPID = false;
+  verifyElementsOn = false;
+  verifyMaxTemperature = 260;
+  verifyMaxDuty[TYPE_BOTTOM_ELEMENT] = 100;
+  verifyMaxDuty[TYPE_TOP_ELEMENT] = 75;
+  verifyMaxDuty[TYPE_BOOST_ELEMENT] = 60;
+  verifyTarget = 0;
+  profileErrorMessage[0] = 0;
+  profileErrorLine = 0;
+}
+
+
+// Remember the error and the line it is on.  Always returns false
+boolean profileError(const char *message)
+{
+  strncpy(profileErrorMessage, message, sizeof(profileErrorMessage) - 1);
+  profileErrorMessage[sizeof(profileErrorMessage) - 1] = 0;
+  profileErrorLine = profileReader.line();
+  SerialUSB.println("ERROR on line " + String(profileErrorLine) + ": " + String(profileErrorMessage));
+  return false;
+}
+
+
+// Check an instruction against the state the oven will be in when it runs.  numbers can be NULL for
+// instructions that don't take numbers.  Returns false if the profile must be rejected
+boolean verifyInstruction(uint8_t token, uint16_t *numbers)
+{
+  char message[50];
+  uint8_t i;
+
+  if (token == TOKEN_NAME) {
+    verifyHasName = true;
+    return true;
+  }
+  if (!verifyHasName)
+    return profileError("\"name\" must be the first instruction");
+
+  switch (token) {
+    case TOKEN_MAX_DUTY:
+      for (i = TYPE_BOTTOM_ELEMENT; i <= TYPE_BOOST_ELEMENT; i++) {
+        if (numbers[i - TYPE_BOTTOM_ELEMENT] > 100)
+          return profileError("Maximum duty must be 0 to 100%");
+        verifyMaxDuty[i] = numbers[i - TYPE_BOTTOM_ELEMENT];
+      }
+      break;
+
+    case TOKEN_ELEMENT_DUTY_CYCLES:
+      verifyElementsOn = false;
+      for (i = TYPE_BOTTOM_ELEMENT; i <= TYPE_BOOST_ELEMENT; i++) {
+        if (numbers[i - TYPE_BOTTOM_ELEMENT] > verifyMaxDuty[i]) {
+          sprintf(message, "Duty cycle %d%% is above the maximum %d%%", numbers[i - TYPE_BOTTOM_ELEMENT], verifyMaxDuty[i]);
+          return profileError(message);
+        }
+        if (numbers[i - TYPE_BOTTOM_ELEMENT])
+          verifyElementsOn = true;
+      }
+      verifyIsPID = false;
+      break;
+
+    case TOKEN_BIAS:
+      if (numbers[0] + numbers[1] + numbers[2] == 0)
+        return profileError("Bias can't be 0 for every element");
+      break;
+
+    case TOKEN_DEVIATION:
+      if (numbers[0] < 1 || numbers[0] > 100)
+        return profileError("Deviation must be 1 to 100~C");
+      break;
+
+    case TOKEN_MAX_TEMPERATURE:
+      if (numbers[0] < verifyTarget) {
+        sprintf(message, "Maximum is below earlier target of %d~C", verifyTarget);
+        return profileError(message);
+      }
+      verifyMaxTemperature = numbers[0];
+      break;
+
+    case TOKEN_OVEN_DOOR_OPEN:
+    case TOKEN_OVEN_DOOR_CLOSE:
+      if (numbers[0] > 30)
+        return profileError("Door can take 0 to 30 seconds to move");
+      break;
+
+    case TOKEN_OVEN_DOOR_PERCENT:
+      if (numbers[0] > 100)
+        return profileError("Door percentage must be 0 to 100%");
+      if (numbers[1] > 30)
+        return profileError("Door can take 0 to 30 seconds to move");
+      break;
+
+    case TOKEN_TEMPERATURE_TARGET:
+    case TOKEN_MAINTAIN_TEMP:
+      // The reflow is aborted as soon as the maximum temperature is exceeded
+      if (numbers[0] > verifyMaxTemperature) {
+        sprintf(message, "%d~C is above the maximum of %d~C", numbers[0], verifyMaxTemperature);
+        return profileError(message);
+      }
+      if (numbers[1] == 0)
+        return profileError("Duration must be at least 1 second");
+      verifyTarget = numbers[0];
+      verifyIsPID = true;
+      break;
+
+    case TOKEN_WAIT_FOR_SECONDS:
+      if (verifyIsPID)
+        return profileError("Need \"element duty cycle\" before \"wait for\"");
+      break;
+
+    case TOKEN_WAIT_UNTIL_ABOVE_C:
+      if (verifyIsPID)
+        return profileError("Need \"element duty cycle\" before this wait");
+      // This temperature must be reachable without aborting the reflow
+      if (numbers[0] >= verifyMaxTemperature) {
+        sprintf(message, "%d~C is not below the maximum of %d~C", numbers[0], verifyMaxTemperature);
+        return profileError(message);
+      }
+      if (!verifyElementsOn) {
+        sprintf(message, "Elements are off so %d~C is never reached", numbers[0]);
+        return profileError(message);
+      }
+      verifyTarget = numbers[0];
+      break;
+
+    case TOKEN_WAIT_UNTIL_BELOW_C:
+      if (verifyIsPID)
+        return profileError("Need \"element duty cycle\" before this wait");
+      if (numbers[0] < 25)
+        return profileError("Can't wait to cool below 25~C");
+      break;
+  }
+  return true;
+}
+
+
+// Show why a profile was rejected, for 5 seconds or until the SD card is removed
+void showProfileError(const char *fileName)
+{
+  if (!profileErrorMessage[0])
+    strcpy(profileErrorMessage, "The profile could not be read");
+  if (!profileErrorLine)
+    profileErrorLine = profileReader.line();
+  SerialUSB.println("Rejected " + String(fileName) + " (line " + String(profileErrorLine) + "): " + String(profileErrorMessage));
+
+  tft.fillRect(20, 120, 440, 60, WHITE);
+  sprintf(buffer100Bytes, "Error in %s, line %d:", fileName, profileErrorLine);
+  displayString(24, 120, FONT_9PT_BLACK_ON_WHITE, buffer100Bytes);
+  displayString(24, 150, FONT_9PT_BLACK_ON_WHITE, profileErrorMessage);
+  uint32_t start = millis();
+  while (SD.cardPresent() && millis() - start < 5000)
+    delay(20);
+  tft.fillRect(20, 120, 440, 60, WHITE);
+}
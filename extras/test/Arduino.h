@@ -0,0 +1,39 @@
+// Just enough of the Arduino core to compile the SD library on a PC (see FileWriteTest.cpp and
+// SdReadBench.cpp)
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "Print.h"
+
+typedef bool boolean;
+
+#define F(string)  (string)
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() = 0;
+};
+
+class String {
+  const char *s;
+ public:
+  String(const char *str) : s(str) {}
+  const char *c_str() const { return s; }
+};
+
+// Debug output goes to stdout
+class HostSerial : public Print {
+ public:
+  size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+  using Print::write;
+};
+static HostSerial Serial, SerialUSB;
+
+#endif
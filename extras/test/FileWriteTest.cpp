@@ -0,0 +1,190 @@
+// Host test for the write buffers in Controleo3File.cpp.  Writes of assorted sizes, most of them crossing
+// block boundaries, must reach the file intact and never touch another file's buffer.
+//
+// Build and run it on a PC from this directory:
+//   g++ -I. -o FileWriteTest FileWriteTest.cpp && ./FileWriteTest
+
+#include <stdio.h>
+#include "SdFat.h"
+#include "../../Controleo3File.cpp"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("FAILED line %d: %s\n", __LINE__, #condition); \
+      failures++; \
+    } \
+  } while (0)
+
+// The byte expected at each position of a test file
+static uint8_t pattern(uint32_t position, uint8_t seed)
+{
+  return (uint8_t) (position * 7 + (position >> 9) + seed);
+}
+
+// Write length bytes of the pattern, starting at the file's current position
+static void writePattern(File *file, uint32_t length, uint8_t seed)
+{
+  static uint8_t buf[4096];
+  uint32_t start = file->position();
+  for (uint32_t i = 0; i < length; i++)
+    buf[i] = pattern(start + i, seed);
+  CHECK(file->write(buf, length) == length);
+}
+
+// Is the whole file the pattern?
+static boolean matchesPattern(TestDisk *disk, uint32_t length, uint8_t seed)
+{
+  if (disk->size != length)
+    return false;
+  for (uint32_t i = 0; i < length; i++) {
+    if (disk->data[i] != pattern(i, seed))
+      return false;
+  }
+  return true;
+}
+
+// Are all the write buffers free and empty?
+static boolean buffersAreFree()
+{
+  for (uint8_t i = 0; i < SD_WRITE_BUFFERS; i++) {
+    if (writeBuffers[i].owner || writeBuffers[i].length)
+      return false;
+  }
+  return true;
+}
+
+// A short write, then one that crosses two block boundaries
+static void testCrossingWrite()
+{
+  static TestDisk disk;
+  memset(&disk, 0, sizeof(disk));
+  File file(SdFile(&disk), "CROSS.TXT");
+
+  // The other buffer must not be written to
+  memset(writeBuffers[1].data, 0XA5, sizeof(writeBuffers[1].data));
+  writePattern(&file, 100, 1);
+  writePattern(&file, 1000, 1);
+  CHECK(file.position() == 1100);
+  CHECK(file.size() == 1100);
+  file.close();
+  CHECK(matchesPattern(&disk, 1100, 1));
+  for (uint16_t i = 0; i < sizeof(writeBuffers[1].data); i++) {
+    if (writeBuffers[1].data[i] != 0XA5) {
+      CHECK(writeBuffers[1].data[i] == 0XA5);
+      break;
+    }
+  }
+  CHECK(buffersAreFree());
+}
+
+// Every write size from 1 to 1100 bytes, each after every few starting offsets within a block
+static void testWriteSizes()
+{
+  static TestDisk disk;
+  for (uint16_t first = 0; first < 512; first += 37) {
+    for (uint16_t size = 1; size <= 1100; size++) {
+      memset(&disk, 0, sizeof(disk));
+      File file(SdFile(&disk), "SIZES.TXT");
+      writePattern(&file, first, 2);
+      writePattern(&file, size, 2);
+      writePattern(&file, size, 2);
+      file.close();
+      if (!matchesPattern(&disk, first + size * 2, 2)) {
+        printf("FAILED: %d bytes then 2 x %d bytes\n", first, size);
+        failures++;
+        return;
+      }
+      // Data that fills a block is written to the file a block at a time
+      CHECK(disk.unalignedWrites <= 1);
+    }
+  }
+  CHECK(buffersAreFree());
+}
+
+// Byte at a time, as print() does, with two files open
+static void testTwoFiles()
+{
+  static TestDisk disk1, disk2;
+  memset(&disk1, 0, sizeof(disk1));
+  memset(&disk2, 0, sizeof(disk2));
+  File file1(SdFile(&disk1), "ONE.TXT");
+  File file2(SdFile(&disk2), "TWO.TXT");
+
+  for (uint32_t i = 0; i < 3000; i++) {
+    file1.write(pattern(i, 3));
+    file2.write(pattern(i, 4));
+    if (i % 700 == 0)
+      file2.flush();
+  }
+  file1.close();
+  file2.close();
+  CHECK(matchesPattern(&disk1, 3000, 3));
+  CHECK(matchesPattern(&disk2, 3000, 4));
+  CHECK(buffersAreFree());
+}
+
+// Seeking writes the buffered data first
+static void testSeek()
+{
+  static TestDisk disk;
+  memset(&disk, 0, sizeof(disk));
+  File file(SdFile(&disk), "SEEK.TXT");
+
+  writePattern(&file, 700, 5);
+  CHECK(file.seek(0));
+  writePattern(&file, 10, 5);
+  file.close();
+  CHECK(matchesPattern(&disk, 700, 5));
+  CHECK(buffersAreFree());
+}
+
+// Writing to a file opened for reading fails, and doesn't take a buffer
+static void testReadOnly()
+{
+  static TestDisk disk;
+  memset(&disk, 0, sizeof(disk));
+  disk.readOnly = true;
+  File file(SdFile(&disk), "READ.TXT");
+
+  CHECK(file.write((const uint8_t *) "abc", 3) == 0);
+  CHECK(file.getWriteError());
+  CHECK(buffersAreFree());
+  file.close();
+  CHECK(disk.size == 0);
+}
+
+// A buffered write that can't be written when the file is read is reported
+static void testFailedFlush()
+{
+  static TestDisk disk;
+  uint8_t buf[10];
+  memset(&disk, 0, sizeof(disk));
+  File file(SdFile(&disk), "FAIL.TXT");
+
+  writePattern(&file, 100, 6);
+  CHECK(!file.getWriteError());
+  disk.failWrites = true;
+  file.read(buf, sizeof(buf));
+  CHECK(file.getWriteError());
+  file.close();
+  CHECK(buffersAreFree());
+}
+
+int main()
+{
+  testCrossingWrite();
+  testWriteSizes();
+  testTwoFiles();
+  testSeek();
+  testReadOnly();
+  testFailedFlush();
+  if (failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All file write tests passed\n");
+  return 0;
+}
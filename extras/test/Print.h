@@ -0,0 +1,44 @@
+// Just enough of the Arduino Print class to compile the SD library on a PC
+
+#ifndef Print_h
+#define Print_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+class Print {
+  int write_error;
+ protected:
+  void setWriteError(int err = 1) { write_error = err; }
+ public:
+  Print() : write_error(0) {}
+  int getWriteError() { return write_error; }
+  void clearWriteError() { setWriteError(0); }
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--)
+      n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char *str) { return write((const uint8_t *) str, strlen(str)); }
+  size_t print(const char *str) { return write(str); }
+  size_t print(char c) { return write((uint8_t) c); }
+  size_t print(unsigned long n) {
+    char buf[12];
+    snprintf(buf, sizeof(buf), "%lu", n);
+    return write(buf);
+  }
+  size_t print(unsigned int n) { return print((unsigned long) n); }
+  size_t print(int n) {
+    char buf[12];
+    snprintf(buf, sizeof(buf), "%d", n);
+    return write(buf);
+  }
+  size_t println() { return write("\r\n"); }
+  size_t println(const char *str) { return print(str) + println(); }
+};
+
+#endif
@@ -0,0 +1,135 @@
+// A simulated SD card for running SdVolume and SdFile on a PC (see SdReadBench.cpp).  It has the same
+// interface as Sd2Card, and keeps the blocks in RAM.  Defining the include guard keeps the real
+// Sd2Card.h out.
+//
+// Every operation counts the bytes Sd2Card.cpp would clock over SPI for it, following the commands and
+// waits in Sd2Card.cpp.  The card's access time (Nac in the SD specification) is given in bytes: the
+// number of 0xFF bytes clocked while waiting for the data token.
+
+#ifndef SD2CARD_H_
+#define SD2CARD_H_
+
+#include <Arduino.h>
+#include "../../SdInfo.h"
+
+#define SD_CARD_TYPE_SD1                1
+#define SD_CARD_TYPE_SD2                2
+#define SD_CARD_TYPE_SDHC               3
+
+#define SIM_COMMAND_BYTES    9      // Busy check, 6 command bytes, NCR and R1
+#define SIM_STOP_BYTES       10     // CMD12, the stuff byte, R1 and the busy wait
+#define SIM_BLOCK_BYTES      515    // Data token, 512 bytes and the CRC
+#define SIM_WRITE_BUSY_BYTES 200    // Waiting for flash programming after each block
+#define SIM_FIRST_ACCESS_BYTES 100  // Waiting for the first block after a read command
+#define SIM_NEXT_ACCESS_BYTES 10    // Waiting for each later block of a multiple block read (cards read ahead)
+
+class Sd2Card {
+public:
+  Sd2Card(uint8_t *image, uint32_t blocks) : image_(image), blocks_(blocks), allowMultiRead_(true),
+    inMultiRead_(false), inMultiWrite_(false) { resetCounts(); }
+
+  // Without multiple block reads every block costs a CMD17, as before streaming was added
+  void allowMultiRead(uint8_t allow) { allowMultiRead_ = allow; }
+  void resetCounts() { busBytes = commands = blocksRead = blocksWritten = 0; }
+
+  uint32_t busBytes;        // Bytes clocked over SPI
+  uint32_t commands;        // Commands sent, including CMD12
+  uint32_t blocksRead;
+  uint32_t blocksWritten;
+
+  uint8_t type(void) { return SD_CARD_TYPE_SDHC; }
+  uint8_t isReading(uint32_t block) { return inMultiRead_ && block == multiReadBlock_; }
+  uint8_t isWriting(uint32_t block) { return inMultiWrite_ && block == multiWriteBlock_; }
+
+  uint8_t readBlock(uint32_t block, uint8_t *dst) { return readData(block, 0, 512, dst); }
+
+  uint8_t readData(uint32_t block, uint16_t offset, uint16_t count, uint8_t *dst) {
+    if (count == 0)
+      return true;
+    if (count + offset > 512 || block >= blocks_)
+      return false;
+    if (isReading(block)) {
+      busBytes += SIM_NEXT_ACCESS_BYTES;
+      multiReadBlock_++;
+    }
+    else {
+      command();
+      busBytes += SIM_FIRST_ACCESS_BYTES;
+    }
+    // The whole block is clocked, whatever part of it is wanted
+    busBytes += SIM_BLOCK_BYTES;
+    blocksRead++;
+    memcpy(dst, image_ + block * 512 + offset, count);
+    return true;
+  }
+
+  uint8_t readStart(uint32_t block) {
+    if (!allowMultiRead_)
+      return true;
+    command();
+    inMultiRead_ = true;
+    multiReadBlock_ = block;
+    return true;
+  }
+
+  uint8_t readStop(void) {
+    if (!inMultiRead_)
+      return true;
+    inMultiRead_ = false;
+    commands++;
+    busBytes += SIM_STOP_BYTES;
+    return true;
+  }
+
+  uint8_t writeBlock(uint32_t block, const uint8_t *src) {
+    if (block == 0 || block >= blocks_)
+      return false;
+    if (isWriting(block))
+      multiWriteBlock_++;
+    else
+      command();
+    busBytes += SIM_BLOCK_BYTES + SIM_WRITE_BUSY_BYTES;
+    blocksWritten++;
+    memcpy(image_ + block * 512, src, 512);
+    return true;
+  }
+
+  uint8_t writeStart(uint32_t block, uint32_t eraseCount) {
+    (void) eraseCount;
+    if (block == 0)
+      return false;
+    command();                      // ACMD23 (CMD55 first)
+    command();
+    command();                      // CMD25
+    inMultiWrite_ = true;
+    multiWriteBlock_ = block;
+    return true;
+  }
+
+  uint8_t writeStop(void) {
+    if (!inMultiWrite_)
+      return true;
+    inMultiWrite_ = false;
+    busBytes += 2 + SIM_WRITE_BUSY_BYTES;    // Stop token and the busy wait
+    return true;
+  }
+
+private:
+  uint8_t *image_;
+  uint32_t blocks_;
+  uint8_t allowMultiRead_;
+  uint8_t inMultiRead_;
+  uint32_t multiReadBlock_;
+  uint8_t inMultiWrite_;
+  uint32_t multiWriteBlock_;
+
+  // Any command ends a multiple block read or write first
+  void command() {
+    readStop();
+    writeStop();
+    commands++;
+    busBytes += SIM_COMMAND_BYTES;
+  }
+};
+
+#endif
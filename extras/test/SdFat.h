@@ -0,0 +1,81 @@
+// A RAM-backed stand-in for sdfatlib, so Controleo3File.cpp can be tested on a PC (see FileWriteTest.cpp).
+// Defining the include guards keeps the real SdFat.h and SdFatUtil.h out
+
+#ifndef SdFat_h
+#define SdFat_h
+#define SdFatUtil_h
+
+#include <Arduino.h>
+
+uint8_t const O_READ = 0X01;
+uint8_t const O_RDONLY = O_READ;
+uint8_t const O_WRITE = 0X02;
+uint8_t const O_CREAT = 0X10;
+
+struct dir_t {
+  uint8_t name[11];
+};
+
+class Sd2Card {};
+class SdVolume {};
+
+// The contents of a file.  Every copy of an SdFile shares it
+struct TestDisk {
+  uint8_t data[16384];
+  uint32_t size;
+  uint16_t writes;                  // Calls to SdFile::write()
+  uint16_t unalignedWrites;         // Writes that didn't start on a block boundary
+  uint8_t readOnly;                 // The file was opened without O_WRITE
+  uint8_t failWrites;               // Every write fails, as if the card was removed
+};
+
+class SdFile : public Print {
+  TestDisk *disk_;
+  uint32_t curPosition_;
+ public:
+  SdFile() : disk_(0), curPosition_(0) {}
+  explicit SdFile(TestDisk *disk) : disk_(disk), curPosition_(0) {}
+  uint8_t isOpen() const { return disk_ != 0; }
+  uint8_t isDir() const { return false; }
+  uint8_t isFile() const { return isOpen(); }
+  uint8_t isWritable() const { return !disk_->readOnly; }
+  uint32_t curPosition() const { return curPosition_; }
+  uint32_t fileSize() const { return disk_->size; }
+  uint8_t close() { disk_ = 0; return true; }
+  uint8_t sync() { return true; }
+  uint8_t seekSet(uint32_t pos) {
+    if (pos > disk_->size)
+      return false;
+    curPosition_ = pos;
+    return true;
+  }
+  uint8_t seekCur(uint32_t pos) { return seekSet(curPosition_ + pos); }
+  int16_t read() {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+  }
+  int16_t read(void *buf, uint16_t nbyte) {
+    if (nbyte > disk_->size - curPosition_)
+      nbyte = disk_->size - curPosition_;
+    memcpy(buf, disk_->data + curPosition_, nbyte);
+    curPosition_ += nbyte;
+    return nbyte;
+  }
+  size_t write(uint8_t b) { return write(&b, 1); }
+  size_t write(const void *buf, uint16_t nbyte) {
+    if (disk_->readOnly || disk_->failWrites || curPosition_ + nbyte > sizeof(disk_->data)) {
+      setWriteError();
+      return 0;
+    }
+    disk_->writes++;
+    if (curPosition_ & 0X1FF)
+      disk_->unalignedWrites++;
+    memcpy(disk_->data + curPosition_, buf, nbyte);
+    curPosition_ += nbyte;
+    if (curPosition_ > disk_->size)
+      disk_->size = curPosition_;
+    return nbyte;
+  }
+};
+
+#endif
@@ -0,0 +1,176 @@
+// Host benchmark for sequential file reads.  SdVolume.cpp and SdFile.cpp are built against a simulated
+// SD card (SdCardSim.h), and a contiguous file and a fragmented file are read with and without multiple
+// block reads (CMD18).  The card counts the bytes clocked over SPI, which are converted to a throughput
+// at SPI_CLOCK_HZ.  The data read back is checked against what was written.
+//
+// Build and run it on a PC from this directory:
+//   g++ -I. -o SdReadBench SdReadBench.cpp && ./SdReadBench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "SdCardSim.h"
+#include "../../SdVolume.cpp"
+#include "../../SdFile.cpp"
+
+#ifndef SPI_CLOCK_HZ
+#define SPI_CLOCK_HZ      4000000     // SPI clock used to turn bus bytes into time
+#endif
+
+#define IMAGE_BLOCKS      32768       // 16MB FAT16 volume
+#define BLOCKS_PER_CLUSTER 4
+#define SECTORS_PER_FAT   32
+#define ROOT_ENTRIES      512
+#define FILE_SIZE         (256UL * 1024)
+#define FRAGMENT_SIZE     (BLOCKS_PER_CLUSTER * 512)
+
+static uint8_t image[IMAGE_BLOCKS * 512];
+static Sd2Card card(image, IMAGE_BLOCKS);
+static SdVolume volume;
+static int failures = 0;
+
+
+// The byte expected at each position of a test file
+static uint8_t pattern(uint32_t position, uint8_t seed)
+{
+  return (uint8_t) (position * 13 + (position >> 9) + seed);
+}
+
+
+// Format the image as a FAT16 volume with no partition table
+static void format()
+{
+  memset(image, 0, sizeof(image));
+  fbs_t *boot = (fbs_t *) image;
+  boot->bpb.bytesPerSector = 512;
+  boot->bpb.sectorsPerCluster = BLOCKS_PER_CLUSTER;
+  boot->bpb.reservedSectorCount = 1;
+  boot->bpb.fatCount = 2;
+  boot->bpb.rootDirEntryCount = ROOT_ENTRIES;
+  boot->bpb.totalSectors16 = IMAGE_BLOCKS;
+  boot->bpb.mediaType = 0XF8;
+  boot->bpb.sectorsPerFat16 = SECTORS_PER_FAT;
+  boot->bootSectorSig0 = BOOTSIG0;
+  boot->bootSectorSig1 = BOOTSIG1;
+
+  // The first two FAT entries are reserved
+  for (uint8_t fat = 0; fat < 2; fat++) {
+    uint16_t *entries = (uint16_t *) (image + (1 + fat * SECTORS_PER_FAT) * 512);
+    entries[0] = 0XFFF8;
+    entries[1] = 0XFFFF;
+  }
+}
+
+
+// Mount the volume again, so nothing is left in the block cache
+static uint8_t mount(SdFile *root)
+{
+  if (!volume.init(&card, 0) || !root->openRoot(&volume)) {
+    printf("FAILED: can't mount the volume\n");
+    failures++;
+    return false;
+  }
+  return true;
+}
+
+
+// Write the test files.  SEQ.BIN is written in one go so it is contiguous.  The other two are written
+// a cluster at a time, in turn, so their clusters alternate
+static void writeFiles()
+{
+  static uint8_t buf[FRAGMENT_SIZE];
+  SdFile root, file, frag1, frag2;
+
+  mount(&root);
+  if (!file.open(&root, "SEQ.BIN", O_CREAT | O_RDWR) || !frag1.open(&root, "FRAG1.BIN", O_CREAT | O_RDWR) ||
+      !frag2.open(&root, "FRAG2.BIN", O_CREAT | O_RDWR)) {
+    printf("FAILED: can't create the test files\n");
+    failures++;
+    return;
+  }
+  for (uint32_t position = 0; position < FILE_SIZE; position += FRAGMENT_SIZE) {
+    for (uint16_t i = 0; i < FRAGMENT_SIZE; i++)
+      buf[i] = pattern(position + i, 1);
+    file.write(buf, FRAGMENT_SIZE);
+  }
+  for (uint32_t position = 0; position < FILE_SIZE; position += FRAGMENT_SIZE) {
+    for (uint16_t i = 0; i < FRAGMENT_SIZE; i++)
+      buf[i] = pattern(position + i, 1);
+    frag1.write(buf, FRAGMENT_SIZE);
+    for (uint16_t i = 0; i < FRAGMENT_SIZE; i++)
+      buf[i] = pattern(position + i, 2);
+    frag2.write(buf, FRAGMENT_SIZE);
+  }
+  if (!file.close() || !frag1.close() || !frag2.close()) {
+    printf("FAILED: can't close the test files\n");
+    failures++;
+  }
+  root.close();
+}
+
+
+// Read a whole file readSize bytes at a time, and show the cost
+static void readFile(const char *name, uint8_t seed, uint16_t readSize, uint8_t multiRead)
+{
+  static uint8_t buf[512];
+  SdFile root, file;
+  uint32_t position = 0;
+  int16_t n;
+
+  if (!mount(&root))
+    return;
+  if (!file.open(&root, name, O_READ)) {
+    printf("FAILED: can't open %s\n", name);
+    failures++;
+    return;
+  }
+  card.allowMultiRead(multiRead);
+  card.resetCounts();
+
+  while ((n = file.read(buf, readSize)) > 0) {
+    for (int16_t i = 0; i < n; i++) {
+      if (buf[i] != pattern(position + i, seed)) {
+        printf("FAILED: %s is wrong at %lu\n", name, (unsigned long) (position + i));
+        failures++;
+        file.close();
+        return;
+      }
+    }
+    position += n;
+  }
+  file.close();
+  if (n < 0 || position != FILE_SIZE) {
+    printf("FAILED: read %lu bytes of %s\n", (unsigned long) position, name);
+    failures++;
+    return;
+  }
+
+  double seconds = card.busBytes * 8.0 / SPI_CLOCK_HZ;
+  printf("%-10s %4u  %-6s %8lu %7lu %9.1f %8.0f\n", name, readSize, multiRead? "CMD18": "CMD17",
+         (unsigned long) card.commands, (unsigned long) card.blocksRead, card.busBytes / (FILE_SIZE / 1024.0),
+         FILE_SIZE / 1024.0 / seconds);
+}
+
+
+int main()
+{
+  format();
+  writeFiles();
+
+  printf("Reading %luKB at a %.1fMHz SPI clock.  The card takes %d bytes to start a read, and %d bytes\n",
+         FILE_SIZE / 1024, SPI_CLOCK_HZ / 1000000.0, SIM_FIRST_ACCESS_BYTES, SIM_NEXT_ACCESS_BYTES);
+  printf("between the blocks of a multiple block read\n\n");
+  printf("File       Read  Mode   Commands  Blocks  Bytes/KB     KB/s\n");
+  const uint16_t readSizes[] = {512, 64};
+  for (uint8_t i = 0; i < 2; i++) {
+    readFile("SEQ.BIN", 1, readSizes[i], false);
+    readFile("SEQ.BIN", 1, readSizes[i], true);
+    readFile("FRAG2.BIN", 2, readSizes[i], false);
+    readFile("FRAG2.BIN", 2, readSizes[i], true);
+  }
+
+  if (failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}